@@ -0,0 +1,624 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+#define PIECE_CHUNK_MIN 64
+#define PIECE_CHUNK_MAX 65536
+#define ADD_BLOCK_MIN 4096
+#define ADD_BLOCK_MAX (64 * 1024 * 1024)
+
+static unsigned int pieceSeed = 2463534242u;
+
+static unsigned int piecePriority() {
+    pieceSeed ^= pieceSeed << 13;
+    pieceSeed ^= pieceSeed >> 17;
+    pieceSeed ^= pieceSeed << 5;
+    return pieceSeed;
+}
+
+/* The original buffer may index its newlines sparsely, so line lookups go through the source. */
+static size_t linesLower(const struct textBuffer *b, int source, size_t offset) {
+    return source == PIECE_ORIGINAL ? sourceLineLower(&b->original, offset) : lineIndexLower(&b->addLines, offset);
+}
+
+static size_t linesGet(const struct textBuffer *b, int source, size_t i) {
+    return source == PIECE_ORIGINAL ? sourceLineGet(&b->original, i) : lineIndexGet(&b->addLines, i);
+}
+
+static size_t linesCount(const struct textBuffer *b, int source) {
+    return source == PIECE_ORIGINAL ? sourceLineCount(&b->original) : lineIndexCount(&b->addLines);
+}
+
+static size_t countLines(const struct textBuffer *b, int source, size_t start, size_t length) {
+    return linesLower(b, source, start + length) - linesLower(b, source, start);
+}
+
+static void slabGrow(struct pieceSlab *slab) {
+    size_t n = PIECE_CHUNK_MIN << (slab->chunkCount < 10 ? slab->chunkCount : 10);
+    if (n > PIECE_CHUNK_MAX) n = PIECE_CHUNK_MAX;
+
+    if (slab->chunkCount == slab->chunkCap) {
+        slab->chunkCap = slab->chunkCap ? slab->chunkCap * 2 : 16;
+        slab->chunks = (struct piece **)realloc(slab->chunks, slab->chunkCap * sizeof(struct piece *));
+    }
+    struct piece *chunk = (struct piece *)malloc(n * sizeof(struct piece));
+    slab->chunks[slab->chunkCount++] = chunk;
+
+    for (size_t i = 0; i < n; i++) {
+        chunk[i].right = i + 1 < n ? &chunk[i + 1] : slab->free;
+    }
+    slab->free = chunk;
+}
+
+static void slabFree(struct pieceSlab *slab) {
+    for (size_t i = 0; i < slab->chunkCount; i++) {
+        free(slab->chunks[i]);
+    }
+    free(slab->chunks);
+    memset(slab, 0, sizeof(*slab));
+}
+
+static struct piece *pieceNew(struct textBuffer *b, int source, size_t start, size_t length, size_t lf) {
+    if (b->slab.free == NULL) slabGrow(&b->slab);
+
+    struct piece *p = b->slab.free;
+    b->slab.free = p->right;
+    p->source = source;
+    p->start = start;
+    p->length = length;
+    p->lf = lf;
+    p->total = length;
+    p->lfTotal = lf;
+    p->priority = piecePriority();
+    p->left = NULL;
+    p->right = NULL;
+    p->parent = NULL;
+    return p;
+}
+
+static void pieceFreeAll(struct textBuffer *b, struct piece *p) {
+    if (p == NULL) return;
+    pieceFreeAll(b, p->left);
+    pieceFreeAll(b, p->right);
+    p->right = b->slab.free;
+    b->slab.free = p;
+}
+
+static size_t pieceTotal(const struct piece *p) {
+    return p ? p->total : 0;
+}
+
+static size_t pieceLfTotal(const struct piece *p) {
+    return p ? p->lfTotal : 0;
+}
+
+static void pieceUpdate(struct piece *p) {
+    p->total = pieceTotal(p->left) + p->length + pieceTotal(p->right);
+    p->lfTotal = pieceLfTotal(p->left) + p->lf + pieceLfTotal(p->right);
+    if (p->left) p->left->parent = p;
+    if (p->right) p->right->parent = p;
+}
+
+static struct piece *pieceMerge(struct piece *a, struct piece *b) {
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+
+    if (a->priority > b->priority) {
+        a->right = pieceMerge(a->right, b);
+        pieceUpdate(a);
+        return a;
+    }
+    b->left = pieceMerge(a, b->left);
+    pieceUpdate(b);
+    return b;
+}
+
+/* Splits the tree so that *l holds the first `offset` bytes, cutting a piece in two if needed. */
+static void pieceSplit(struct textBuffer *b, struct piece *t, size_t offset,
+                       struct piece **l, struct piece **r) {
+    if (t == NULL) {
+        *l = NULL;
+        *r = NULL;
+        return;
+    }
+
+    size_t leftTotal = pieceTotal(t->left);
+    if (offset <= leftTotal) {
+        pieceSplit(b, t->left, offset, l, &t->left);
+        pieceUpdate(t);
+        *r = t;
+    } else if (offset >= leftTotal + t->length) {
+        pieceSplit(b, t->right, offset - leftTotal - t->length, &t->right, r);
+        pieceUpdate(t);
+        *l = t;
+    } else {
+        size_t cut = offset - leftTotal;
+        size_t headLf = countLines(b, t->source, t->start, cut);
+        struct piece *tail = pieceNew(b, t->source, t->start + cut, t->length - cut, t->lf - headLf);
+        struct piece *right = t->right;
+
+        t->length = cut;
+        t->lf = headLf;
+        t->right = NULL;
+        pieceUpdate(t);
+        *l = t;
+        *r = pieceMerge(tail, right);
+    }
+}
+
+/*
+ * Builds a tree from pieces handed over in document order, in linear time: the stack holds the
+ * right spine, and each new piece adopts the part of it with lower priority as its left subtree.
+ */
+struct pieceBuilder {
+    struct piece **stack;
+    size_t depth, cap;
+};
+
+static void builderPush(struct pieceBuilder *builder, struct piece *p) {
+    struct piece *last = NULL;
+    while (builder->depth > 0 && builder->stack[builder->depth - 1]->priority < p->priority) {
+        last = builder->stack[--builder->depth];
+        pieceUpdate(last);
+    }
+    p->left = last;
+    if (builder->depth > 0) builder->stack[builder->depth - 1]->right = p;
+
+    if (builder->depth == builder->cap) {
+        builder->cap = builder->cap ? builder->cap * 2 : 64;
+        builder->stack = (struct piece **)realloc(builder->stack, builder->cap * sizeof(struct piece *));
+    }
+    builder->stack[builder->depth++] = p;
+}
+
+static struct piece *builderFinish(struct pieceBuilder *builder) {
+    while (builder->depth > 0) pieceUpdate(builder->stack[--builder->depth]);
+    struct piece *root = builder->cap ? builder->stack[0] : NULL;
+    free(builder->stack);
+    return root;
+}
+
+static struct piece *pieceFind(struct piece *p, size_t offset, size_t *inner) {
+    while (p) {
+        size_t leftTotal = pieceTotal(p->left);
+        if (offset < leftTotal) {
+            p = p->left;
+        } else if (offset < leftTotal + p->length) {
+            *inner = offset - leftTotal;
+            return p;
+        } else {
+            offset -= leftTotal + p->length;
+            p = p->right;
+        }
+    }
+    return NULL;
+}
+
+static struct piece *pieceNext(struct piece *p) {
+    if (p->right) {
+        p = p->right;
+        while (p->left) p = p->left;
+        return p;
+    }
+    while (p->parent && p == p->parent->right) p = p->parent;
+    return p->parent;
+}
+
+static void pieceGrow(struct piece *p, size_t len, size_t lf) {
+    p->length += len;
+    p->lf += lf;
+    for (; p; p = p->parent) {
+        p->total += len;
+        p->lfTotal += lf;
+    }
+}
+
+/* Block holding add-buffer `offset`; a piece never spans two blocks. */
+static const struct addBlock *addBlockFind(const struct textBuffer *b, size_t offset) {
+    size_t lo = 0, hi = b->addBlockCount;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->addBlocks[mid].start <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &b->addBlocks[lo];
+}
+
+/*
+ * Add text goes into blocks that grow geometrically and never move, leaving a gap in the
+ * offset space between blocks so a piece can only be extended within its own block.
+ */
+static size_t addAppend(struct textBuffer *b, const char *s, size_t len) {
+    struct addBlock *last = b->addBlockCount ? &b->addBlocks[b->addBlockCount - 1] : NULL;
+
+    if (last == NULL || last->cap - last->size < len) {
+        size_t cap = last ? last->cap * 2 : ADD_BLOCK_MIN;
+        size_t start = last ? last->start + last->cap + 1 : 0;
+        if (cap > ADD_BLOCK_MAX) cap = ADD_BLOCK_MAX;
+        if (cap < len) cap = len;
+
+        if (b->addBlockCount == b->addBlockCap) {
+            b->addBlockCap = b->addBlockCap ? b->addBlockCap * 2 : 8;
+            b->addBlocks = (struct addBlock *)realloc(b->addBlocks, b->addBlockCap * sizeof(struct addBlock));
+        }
+        last = &b->addBlocks[b->addBlockCount++];
+        last->chars = (char *)malloc(cap);
+        last->start = start;
+        last->size = 0;
+        last->cap = cap;
+    }
+
+    size_t start = last->start + last->size;
+    memcpy(last->chars + last->size, s, len);
+    last->size += len;
+    return start;
+}
+
+static const char *pieceChars(const struct textBuffer *b, const struct piece *p) {
+    if (p->source == PIECE_ORIGINAL) return b->original.chars + p->start;
+
+    const struct addBlock *block = addBlockFind(b, p->start);
+    return block->chars + (p->start - block->start);
+}
+
+static void setRoot(struct textBuffer *b, struct piece *root) {
+    b->root = root;
+    if (root) root->parent = NULL;
+}
+
+/* Document offset of the `k`-th newline (1-based), found by descending on subtree line counts. */
+static size_t newlineOffset(const struct textBuffer *b, size_t k) {
+    struct piece *p = b->root;
+    size_t base = 0;
+
+    while (p) {
+        size_t leftLf = pieceLfTotal(p->left);
+        if (k <= leftLf) {
+            p = p->left;
+        } else if (k <= leftLf + p->lf) {
+            size_t nth = linesLower(b, p->source, p->start) + (k - leftLf) - 1;
+            return base + pieceTotal(p->left) + linesGet(b, p->source, nth) - p->start;
+        } else {
+            k -= leftLf + p->lf;
+            base += pieceTotal(p->left) + p->length;
+            p = p->right;
+        }
+    }
+    return base;
+}
+
+void bufferInit(struct textBuffer *b) {
+    memset(b, 0, sizeof(*b));
+    sourceInit(&b->original);
+}
+
+void bufferFree(struct textBuffer *b) {
+    slabFree(&b->slab);
+    sourceFree(&b->original);
+    for (size_t i = 0; i < b->addBlockCount; i++) {
+        free(b->addBlocks[i].chars);
+    }
+    free(b->addBlocks);
+    lineIndexFree(&b->addLines);
+    memset(b, 0, sizeof(*b));
+}
+
+size_t bufferLength(const struct textBuffer *b) {
+    return pieceTotal(b->root);
+}
+
+size_t bufferLineCount(const struct textBuffer *b) {
+    return pieceLfTotal(b->root) + 1;
+}
+
+size_t bufferLineStart(const struct textBuffer *b, size_t line) {
+    if (line == 0) return 0;
+    if (line >= bufferLineCount(b)) return bufferLength(b);
+    return newlineOffset(b, line) + 1;
+}
+
+size_t bufferLineSize(const struct textBuffer *b, size_t line) {
+    if (line >= bufferLineCount(b)) return 0;
+
+    size_t start = bufferLineStart(b, line);
+    size_t end = bufferLength(b);
+    if (line + 1 < bufferLineCount(b)) {
+        end = newlineOffset(b, line + 1);
+        if (end > start && bufferCharAt(b, end - 1) == '\r') end--;
+    }
+    return end - start;
+}
+
+size_t bufferLineOf(const struct textBuffer *b, size_t offset) {
+    struct piece *p = b->root;
+    size_t line = 0;
+
+    if (offset >= bufferLength(b)) return pieceLfTotal(b->root);
+
+    while (p) {
+        size_t leftTotal = pieceTotal(p->left);
+        if (offset < leftTotal) {
+            p = p->left;
+        } else if (offset < leftTotal + p->length) {
+            line += pieceLfTotal(p->left);
+            return line + countLines(b, p->source, p->start, offset - leftTotal);
+        } else {
+            line += pieceLfTotal(p->left) + p->lf;
+            offset -= leftTotal + p->length;
+            p = p->right;
+        }
+    }
+    return line;
+}
+
+int bufferOpen(struct textBuffer *b, const char *filename, size_t minLines, bool sparse) {
+    if (sourceOpen(&b->original, filename, minLines, sparse) == -1) return -1;
+
+    b->crlf = b->original.crlf;
+    if (b->original.size > 0) {
+        size_t lf = sourceLineCount(&b->original);
+        setRoot(b, pieceNew(b, PIECE_ORIGINAL, 0, b->original.size, lf));
+    }
+    b->version++;
+    return 0;
+}
+
+/* While the scanner runs the document is a single original piece whose line count trails the index. */
+void bufferSync(struct textBuffer *b, bool wait) {
+    if (!b->original.scanning) return;
+
+    if (wait) {
+        sourceWait(&b->original);
+    } else {
+        sourceScanning(&b->original);
+    }
+
+    size_t lf = sourceLineCount(&b->original);
+    if (b->root && b->root->lf != lf) {
+        b->root->lf = lf;
+        b->root->lfTotal = lf;
+        b->version++;
+    }
+    b->crlf = b->original.crlf;
+}
+
+bool bufferIndexing(struct textBuffer *b) {
+    bufferSync(b, false);
+    return b->original.scanning;
+}
+
+int bufferIndexProgress(const struct textBuffer *b) {
+    if (b->original.size == 0) return 100;
+    return (int)(sourceScanned(&b->original) * 100 / b->original.size);
+}
+
+int bufferCharAt(const struct textBuffer *b, size_t offset) {
+    size_t inner;
+    struct piece *p = pieceFind(b->root, offset, &inner);
+    if (p == NULL) return -1;
+    return (unsigned char)pieceChars(b, p)[inner];
+}
+
+size_t bufferChunk(const struct textBuffer *b, size_t offset, const char **chars) {
+    size_t inner;
+    struct piece *p = pieceFind(b->root, offset, &inner);
+    if (p == NULL) return 0;
+
+    *chars = pieceChars(b, p) + inner;
+    return p->length - inner;
+}
+
+/* Contiguous bytes of the piece that end at `offset`, for walking the text backwards. */
+size_t bufferChunkBefore(const struct textBuffer *b, size_t offset, const char **chars) {
+    if (offset == 0) return 0;
+
+    size_t inner;
+    struct piece *p = pieceFind(b->root, offset - 1, &inner);
+    if (p == NULL) return 0;
+
+    *chars = pieceChars(b, p);
+    return inner + 1;
+}
+
+size_t bufferRead(const struct textBuffer *b, size_t offset, char *dst, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        const char *chars;
+        size_t n = bufferChunk(b, offset + done, &chars);
+        if (n == 0) break;
+        if (n > len - done) n = len - done;
+        memcpy(dst + done, chars, n);
+        done += n;
+    }
+    return done;
+}
+
+void bufferInsert(struct textBuffer *b, size_t offset, const char *s, size_t len) {
+    if (len == 0) return;
+    bufferSync(b, true);
+    if (offset > bufferLength(b)) offset = bufferLength(b);
+
+    size_t addStart = addAppend(b, s, len);
+    b->version++;
+
+    size_t lf = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\n') {
+            lineIndexPush(&b->addLines, addStart + i);
+            lf++;
+        }
+    }
+
+    size_t inner = 0;
+    struct piece *prev = offset > 0 ? pieceFind(b->root, offset - 1, &inner) : NULL;
+    if (prev && prev->source == PIECE_ADD && inner == prev->length - 1 &&
+        prev->start + prev->length == addStart) {
+        pieceGrow(prev, len, lf);
+    } else {
+        struct piece *left, *right;
+        pieceSplit(b, b->root, offset, &left, &right);
+        setRoot(b, pieceMerge(pieceMerge(left, pieceNew(b, PIECE_ADD, addStart, len, lf)), right));
+    }
+}
+
+void bufferDelete(struct textBuffer *b, size_t offset, size_t len) {
+    bufferSync(b, true);
+
+    size_t length = bufferLength(b);
+    if (offset >= length || len == 0) return;
+    if (len > length - offset) len = length - offset;
+
+    struct piece *left, *middle, *right;
+    pieceSplit(b, b->root, offset, &left, &right);
+    pieceSplit(b, right, len, &middle, &right);
+    pieceFreeAll(b, middle);
+    setRoot(b, pieceMerge(left, right));
+    b->version++;
+}
+
+/*
+ * Replaces the `count` ranges [starts[i], ends[i]), sorted and disjoint, in one pass: each with
+ * all `len` bytes of `s`, or when `lens` is given, with the next lens[i] bytes of it. The text is
+ * added once and the ranges point pieces into it; the text between ranges is cut out of the old
+ * pieces as they are walked, and the new tree is built in linear time.
+ */
+static void replaceRanges(struct textBuffer *b, const size_t *starts, const size_t *ends, size_t count,
+                          const char *s, size_t len, const size_t *lens) {
+    if (count == 0) return;
+    bufferSync(b, true);
+
+    size_t addStart = 0, total = len;
+    if (lens) {
+        total = 0;
+        for (size_t i = 0; i < count; i++) total += lens[i];
+    }
+    if (total > 0) {
+        addStart = addAppend(b, s, total);
+        for (size_t i = 0; i < total; i++) {
+            if (s[i] == '\n') lineIndexPush(&b->addLines, addStart + i);
+        }
+    }
+    size_t addLf = lens || len == 0 ? 0 : countLines(b, PIECE_ADD, addStart, len);
+
+    struct pieceBuilder builder = {NULL, 0, 0};
+    struct piece *p = b->root;
+    while (p && p->left) p = p->left;
+    size_t pieceStart = 0, pos = 0, at = addStart;
+    size_t length = bufferLength(b);
+
+    for (size_t i = 0; i <= count; i++) {
+        size_t to = i < count ? starts[i] : length;
+        while (pos < to) {
+            while (pieceStart + p->length <= pos) {
+                pieceStart += p->length;
+                p = pieceNext(p);
+            }
+            size_t inner = pos - pieceStart;
+            size_t n = (to < pieceStart + p->length ? to : pieceStart + p->length) - pos;
+            size_t lf = n == p->length ? p->lf : countLines(b, p->source, p->start + inner, n);
+            builderPush(&builder, pieceNew(b, p->source, p->start + inner, n, lf));
+            pos += n;
+        }
+        if (i == count) break;
+
+        if (lens && lens[i] > 0) {
+            builderPush(&builder, pieceNew(b, PIECE_ADD, at, lens[i], countLines(b, PIECE_ADD, at, lens[i])));
+            at += lens[i];
+        } else if (!lens && len > 0) {
+            builderPush(&builder, pieceNew(b, PIECE_ADD, addStart, len, addLf));
+        }
+        pos = ends[i];
+    }
+
+    pieceFreeAll(b, b->root);
+    setRoot(b, builderFinish(&builder));
+    b->version++;
+}
+
+/* Replaces every range with the same text, which is stored once however many ranges there are. */
+void bufferReplace(struct textBuffer *b, const size_t *starts, const size_t *ends, size_t count,
+                   const char *s, size_t len) {
+    replaceRanges(b, starts, ends, count, s, len, NULL);
+}
+
+/* Replaces range i with the next lens[i] bytes of `s`. */
+void bufferReplaceEach(struct textBuffer *b, const size_t *starts, const size_t *ends, size_t count,
+                       const char *s, const size_t *lens) {
+    replaceRanges(b, starts, ends, count, s, 0, lens);
+}
+
+void bufferIterSeek(struct bufferIter *it, const struct textBuffer *b, size_t offset) {
+    it->b = b;
+    it->inner = 0;
+    it->offset = offset;
+    it->piece = pieceFind(b->root, offset, &it->inner);
+}
+
+/* Offset of the newline ending the line that holds `offset`, or the end of the text on the last line. */
+static size_t lineEnd(const struct textBuffer *b, size_t offset) {
+    size_t line = bufferLineOf(b, offset);
+    return line + 1 < bufferLineCount(b) ? newlineOffset(b, line + 1) : bufferLength(b);
+}
+
+/*
+ * Copies at most `max` bytes of the line under the iterator, starting `skip` bytes into it, and
+ * moves it to the next line start. A line spread over many pieces is only walked while bytes are
+ * being copied; the skipped head and the rest past the window are crossed with one tree descent.
+ */
+size_t bufferIterLine(struct bufferIter *it, size_t skip, char *dst, size_t max) {
+    size_t start = it->offset;
+    size_t copied = 0;
+
+    while (it->piece) {
+        struct piece *p = it->piece;
+        size_t end = p->length;
+        bool found = false;
+
+        if (p->lf > 0) {
+            size_t nth = linesLower(it->b, p->source, p->start + it->inner);
+            if (nth < linesCount(it->b, p->source) && linesGet(it->b, p->source, nth) < p->start + p->length) {
+                end = linesGet(it->b, p->source, nth) - p->start;
+                found = true;
+            }
+        }
+
+        size_t from = it->inner;
+        size_t before = it->offset - start;
+        if (before < skip) from += skip - before < end - from ? skip - before : end - from;
+        if (copied < max) {
+            size_t n = end - from;
+            if (n > max - copied) n = max - copied;
+            memcpy(dst + copied, pieceChars(it->b, p) + from, n);
+            copied += n;
+        }
+
+        if (found) {
+            size_t size = it->offset + end - it->inner - start;
+            if (copied > 0 && skip + copied == size && dst[copied - 1] == '\r') copied--;
+
+            it->offset += end + 1 - it->inner;
+            it->inner = end + 1;
+            if (it->inner == p->length) {
+                it->piece = pieceNext(p);
+                it->inner = 0;
+            }
+            return copied;
+        }
+
+        it->offset += p->length - it->inner;
+        it->piece = pieceNext(p);
+        it->inner = 0;
+
+        size_t walked = it->offset - start;
+        if (it->piece && (copied == max || walked < skip)) {
+            size_t target = lineEnd(it->b, it->offset);
+            if (copied < max && start + skip < target) target = start + skip;
+            bufferIterSeek(it, it->b, target);
+        }
+    }
+    return copied;
+}
@@ -0,0 +1,85 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "source.h"
+
+enum pieceSource {
+    PIECE_ORIGINAL,
+    PIECE_ADD
+};
+
+struct piece {
+    int source;
+    size_t start;
+    size_t length;
+    size_t lf;
+    size_t total;
+    size_t lfTotal;
+    unsigned int priority;
+    struct piece *left;
+    struct piece *right;
+    struct piece *parent;
+};
+
+struct pieceSlab {
+    struct piece *free;
+    struct piece **chunks;
+    size_t chunkCount, chunkCap;
+};
+
+struct addBlock {
+    char *chars;
+    size_t start;
+    size_t size, cap;
+};
+
+struct textBuffer {
+    struct piece *root;
+    struct pieceSlab slab;
+    struct textSource original;
+    struct addBlock *addBlocks;
+    size_t addBlockCount, addBlockCap;
+    struct lineIndex addLines;
+    unsigned long version;
+    bool crlf;
+};
+
+struct bufferIter {
+    const struct textBuffer *b;
+    struct piece *piece;
+    size_t inner;
+    size_t offset;
+};
+
+void bufferInit(struct textBuffer *b);
+void bufferFree(struct textBuffer *b);
+int bufferOpen(struct textBuffer *b, const char *filename, size_t minLines, bool sparse);
+void bufferSync(struct textBuffer *b, bool wait);
+bool bufferIndexing(struct textBuffer *b);
+int bufferIndexProgress(const struct textBuffer *b);
+
+size_t bufferLength(const struct textBuffer *b);
+size_t bufferLineCount(const struct textBuffer *b);
+size_t bufferLineStart(const struct textBuffer *b, size_t line);
+size_t bufferLineSize(const struct textBuffer *b, size_t line);
+size_t bufferLineOf(const struct textBuffer *b, size_t offset);
+
+int bufferCharAt(const struct textBuffer *b, size_t offset);
+size_t bufferChunk(const struct textBuffer *b, size_t offset, const char **chars);
+size_t bufferChunkBefore(const struct textBuffer *b, size_t offset, const char **chars);
+size_t bufferRead(const struct textBuffer *b, size_t offset, char *dst, size_t len);
+
+void bufferInsert(struct textBuffer *b, size_t offset, const char *s, size_t len);
+void bufferDelete(struct textBuffer *b, size_t offset, size_t len);
+void bufferReplace(struct textBuffer *b, const size_t *starts, const size_t *ends, size_t count,
+                   const char *s, size_t len);
+void bufferReplaceEach(struct textBuffer *b, const size_t *starts, const size_t *ends, size_t count,
+                       const char *s, const size_t *lens);
+
+void bufferIterSeek(struct bufferIter *it, const struct textBuffer *b, size_t offset);
+size_t bufferIterLine(struct bufferIter *it, size_t skip, char *dst, size_t max);
+
+#endif
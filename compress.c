@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "compress.h"
+
+/* Compressed bytes are read and written in buffers of this size. */
+#define COMPRESS_BLOCK ((size_t)256 << 10)
+
+/* zlib counts in unsigned ints, so longer inputs are fed in slices. */
+#define COMPRESS_SLICE ((size_t)1 << 30)
+
+enum compressFormat compressDetect(const unsigned char *head, size_t len) {
+#if defined(HAVE_ZLIB)
+    if (len >= 2 && head[0] == 0x1f && head[1] == 0x8b) return COMPRESS_GZIP;
+#endif
+#if defined(HAVE_ZSTD)
+    if (len >= 4 && head[0] == 0x28 && head[1] == 0xb5 && head[2] == 0x2f && head[3] == 0xfd) return COMPRESS_ZSTD;
+#endif
+    (void)head;
+    (void)len;
+    return COMPRESS_NONE;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+static bool hasSuffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n > m && strcmp(s + n - m, suffix) == 0;
+}
+#endif
+
+/* A new file is saved in the format its name asks for, so `x.log.gz` is written compressed and `x.log` is not. */
+enum compressFormat compressFormatFor(const char *filename) {
+#if defined(HAVE_ZLIB)
+    if (hasSuffix(filename, ".gz")) return COMPRESS_GZIP;
+#endif
+#if defined(HAVE_ZSTD)
+    if (hasSuffix(filename, ".zst")) return COMPRESS_ZSTD;
+#endif
+    (void)filename;
+    return COMPRESS_NONE;
+}
+
+const char *compressName(enum compressFormat format) {
+    switch (format) {
+        case COMPRESS_GZIP: return "gzip";
+        case COMPRESS_ZSTD: return "zstd";
+        default: return "plain";
+    }
+}
+
+/* Reads the first block to tell the format from its magic bytes; it is replayed for plain text. */
+void decoderInit(struct decoder *d, FILE *fp) {
+    memset(d, 0, sizeof(*d));
+    d->fp = fp;
+    d->in = (unsigned char *)malloc(COMPRESS_BLOCK);
+    d->inLen = fread(d->in, 1, COMPRESS_BLOCK, fp);
+    d->format = compressDetect(d->in, d->inLen);
+
+#if defined(HAVE_ZLIB)
+    /* 15 + 32 accepts both gzip and zlib headers. */
+    if (d->format == COMPRESS_GZIP && inflateInit2(&d->z, 15 + 32) != Z_OK) d->format = COMPRESS_NONE;
+#endif
+#if defined(HAVE_ZSTD)
+    if (d->format == COMPRESS_ZSTD) {
+        d->zstd = ZSTD_createDStream();
+        if (d->zstd == NULL || ZSTD_isError(ZSTD_initDStream(d->zstd))) d->format = COMPRESS_NONE;
+    }
+#endif
+}
+
+/* Inflates from the pending input into `out`; `ended` records whether the last member or frame is complete. */
+static int decoderStep(struct decoder *d, char *out, size_t outLen, size_t *used, size_t *made) {
+#if defined(HAVE_ZLIB)
+    if (d->format == COMPRESS_GZIP) {
+        /* Zero bytes after a member are padding, as tape and dd leave; gzip -d ignores them too. */
+        if (d->ended && d->inPos < d->inLen && d->in[d->inPos] == 0) {
+            size_t pad = 0;
+            while (d->inPos + pad < d->inLen && d->in[d->inPos + pad] == 0) pad++;
+            *used = pad;
+            *made = 0;
+            return 0;
+        }
+        size_t inLen = d->inLen - d->inPos;
+        if (outLen > COMPRESS_SLICE) outLen = COMPRESS_SLICE;
+        d->z.next_in = d->in + d->inPos;
+        d->z.avail_in = (uInt)inLen;
+        d->z.next_out = (Bytef *)out;
+        d->z.avail_out = (uInt)outLen;
+
+        int r = inflate(&d->z, Z_NO_FLUSH);
+        *used = inLen - d->z.avail_in;
+        *made = outLen - d->z.avail_out;
+        if (r == Z_STREAM_END) {
+            /* Concatenated members, as `cat a.gz b.gz` makes, read as one text. */
+            d->ended = true;
+            return inflateReset(&d->z) == Z_OK ? 0 : -1;
+        }
+        if (r != Z_OK && r != Z_BUF_ERROR) return -1;
+        d->ended = false;
+        return 0;
+    }
+#endif
+#if defined(HAVE_ZSTD)
+    if (d->format == COMPRESS_ZSTD) {
+        ZSTD_inBuffer in = { d->in + d->inPos, d->inLen - d->inPos, 0 };
+        ZSTD_outBuffer o = { out, outLen, 0 };
+        size_t r = ZSTD_decompressStream(d->zstd, &o, &in);
+        if (ZSTD_isError(r)) return -1;
+        *used = in.pos;
+        *made = o.pos;
+        d->ended = r == 0;
+        return 0;
+    }
+#endif
+    (void)d;
+    (void)out;
+    (void)outLen;
+    *used = 0;
+    *made = 0;
+    return -1;
+}
+
+/* Fills `dst` with up to `max` bytes of text. Returns 0 at the end and -1 on a read error or a corrupt or cut-off stream. */
+long decoderRead(struct decoder *d, char *dst, size_t max) {
+    if (d->format == COMPRESS_NONE) {
+        if (d->inPos < d->inLen) {
+            size_t n = d->inLen - d->inPos < max ? d->inLen - d->inPos : max;
+            memcpy(dst, d->in + d->inPos, n);
+            d->inPos += n;
+            return (long)n;
+        }
+        size_t n = fread(dst, 1, max, d->fp);
+        return n == 0 && ferror(d->fp) ? -1 : (long)n;
+    }
+
+    size_t done = 0;
+    while (done < max) {
+        if (d->inPos == d->inLen && !d->eof) {
+            d->inPos = 0;
+            d->inLen = fread(d->in, 1, COMPRESS_BLOCK, d->fp);
+            d->eof = d->inLen == 0;
+            if (d->eof && ferror(d->fp)) return done ? (long)done : -1;
+        }
+        if (d->eof && d->ended) break;
+
+        /* Past the last input the codec may still hold output; a step that yields none means the stream was cut off. */
+        size_t used, made;
+        if (decoderStep(d, dst + done, max - done, &used, &made) == -1 || (used == 0 && made == 0)) {
+            if (done) return (long)done;
+            errno = EIO;
+            return -1;
+        }
+        d->inPos += used;
+        done += made;
+    }
+    return (long)done;
+}
+
+void decoderFree(struct decoder *d) {
+#if defined(HAVE_ZLIB)
+    if (d->format == COMPRESS_GZIP) inflateEnd(&d->z);
+#endif
+#if defined(HAVE_ZSTD)
+    if (d->zstd) ZSTD_freeDStream(d->zstd);
+#endif
+    free(d->in);
+    memset(d, 0, sizeof(*d));
+}
+
+int encoderInit(struct encoder *e, enum compressFormat format, int (*sink)(void *, const char *, size_t), void *ctx) {
+    memset(e, 0, sizeof(*e));
+    e->format = format;
+    e->sink = sink;
+    e->ctx = ctx;
+    e->out = (unsigned char *)malloc(COMPRESS_BLOCK);
+
+#if defined(HAVE_ZLIB)
+    /* 15 + 16 writes a gzip header rather than a zlib one. */
+    if (format == COMPRESS_GZIP) {
+        return deflateInit2(&e->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+    }
+#endif
+#if defined(HAVE_ZSTD)
+    if (format == COMPRESS_ZSTD) {
+        e->zstd = ZSTD_createCStream();
+        /* Level 3 is zstd's own default. */
+        return e->zstd && !ZSTD_isError(ZSTD_initCStream(e->zstd, 3)) ? 0 : -1;
+    }
+#endif
+    return format == COMPRESS_NONE ? 0 : -1;
+}
+
+/* Deflates `len` bytes, or with `finish` flushes the end of the stream, passing every filled buffer to the sink. */
+static int encoderStep(struct encoder *e, const char *chars, size_t len, bool finish) {
+#if defined(HAVE_ZLIB)
+    if (e->format == COMPRESS_GZIP) {
+        e->z.next_in = (Bytef *)chars;
+        e->z.avail_in = (uInt)len;
+        do {
+            e->z.next_out = e->out;
+            e->z.avail_out = (uInt)COMPRESS_BLOCK;
+            if (deflate(&e->z, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) return -1;
+
+            size_t n = COMPRESS_BLOCK - e->z.avail_out;
+            if (n > 0 && e->sink(e->ctx, (const char *)e->out, n) == -1) return -1;
+        } while (e->z.avail_out == 0);
+        return 0;
+    }
+#endif
+#if defined(HAVE_ZSTD)
+    if (e->format == COMPRESS_ZSTD) {
+        ZSTD_inBuffer in = { chars, len, 0 };
+        size_t left;
+        do {
+            ZSTD_outBuffer o = { e->out, COMPRESS_BLOCK, 0 };
+            left = finish ? ZSTD_endStream(e->zstd, &o) : ZSTD_compressStream(e->zstd, &o, &in);
+            if (ZSTD_isError(left)) return -1;
+            if (o.pos > 0 && e->sink(e->ctx, (const char *)e->out, o.pos) == -1) return -1;
+        } while (finish ? left > 0 : in.pos < in.size);
+        return 0;
+    }
+#endif
+    (void)finish;
+    return len > 0 ? e->sink(e->ctx, chars, len) : 0;
+}
+
+int encoderWrite(struct encoder *e, const char *chars, size_t len) {
+    while (len > 0) {
+        size_t n = len < COMPRESS_SLICE ? len : COMPRESS_SLICE;
+        if (encoderStep(e, chars, n, false) == -1) return -1;
+        chars += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int encoderFinish(struct encoder *e) {
+    return encoderStep(e, NULL, 0, true);
+}
+
+void encoderFree(struct encoder *e) {
+#if defined(HAVE_ZLIB)
+    if (e->format == COMPRESS_GZIP) deflateEnd(&e->z);
+#endif
+#if defined(HAVE_ZSTD)
+    if (e->zstd) ZSTD_freeCStream(e->zstd);
+#endif
+    free(e->out);
+    memset(e, 0, sizeof(*e));
+}
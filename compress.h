@@ -0,0 +1,65 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#if defined(HAVE_ZLIB)
+    #include <zlib.h>
+#endif
+#if defined(HAVE_ZSTD)
+    #include <zstd.h>
+#endif
+
+/* Only formats the editor was built with are ever detected; anything else is read as plain text. */
+enum compressFormat {
+    COMPRESS_NONE,
+    COMPRESS_GZIP,
+    COMPRESS_ZSTD
+};
+
+/* The text of a file, inflated on the way in when it is compressed. */
+struct decoder {
+    enum compressFormat format;
+    FILE *fp;
+    unsigned char *in;
+    size_t inLen, inPos;
+    bool eof;
+    bool ended;
+#if defined(HAVE_ZLIB)
+    z_stream z;
+#endif
+#if defined(HAVE_ZSTD)
+    ZSTD_DStream *zstd;
+#endif
+};
+
+/* Text on its way out to a file, deflated into `out` and handed to `sink` one full buffer at a time. */
+struct encoder {
+    enum compressFormat format;
+    unsigned char *out;
+    int (*sink)(void *ctx, const char *chars, size_t len);
+    void *ctx;
+#if defined(HAVE_ZLIB)
+    z_stream z;
+#endif
+#if defined(HAVE_ZSTD)
+    ZSTD_CStream *zstd;
+#endif
+};
+
+enum compressFormat compressDetect(const unsigned char *head, size_t len);
+enum compressFormat compressFormatFor(const char *filename);
+const char *compressName(enum compressFormat format);
+
+void decoderInit(struct decoder *d, FILE *fp);
+long decoderRead(struct decoder *d, char *dst, size_t max);
+void decoderFree(struct decoder *d);
+
+int encoderInit(struct encoder *e, enum compressFormat format, int (*sink)(void *, const char *, size_t), void *ctx);
+int encoderWrite(struct encoder *e, const char *chars, size_t len);
+int encoderFinish(struct encoder *e);
+void encoderFree(struct encoder *e);
+
+#endif
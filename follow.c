@@ -0,0 +1,124 @@
+/* For pread and strdup, which strict C99 leaves out. */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+    #if defined(__linux__)
+        #include <sys/inotify.h>
+    #endif
+#else
+    #include <sys/types.h>
+    #include <sys/stat.h>
+#endif
+
+#include "follow.h"
+
+/*
+ * Starts watching `filename`, whose first `size` bytes are already in the buffer. Linux gets
+ * change events from inotify; elsewhere every read checks the file size. The name is kept to
+ * notice when another file takes its place, as when a log is rotated.
+ */
+int followStart(struct fileFollow *f, const char *filename, size_t size) {
+    memset(f, 0, sizeof(*f));
+#if !defined(_WIN32) && !defined(_WIN64)
+    f->fd = open(filename, O_RDONLY);
+    if (f->fd == -1) return -1;
+
+    f->inotify = -1;
+    #if defined(__linux__)
+        f->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (f->inotify != -1 && inotify_add_watch(f->inotify, filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB) == -1) {
+            close(f->inotify);
+            f->inotify = -1;
+        }
+    #endif
+#else
+    f->fp = fopen(filename, "rb");
+    if (f->fp == NULL) return -1;
+#endif
+    f->path = strdup(filename);
+    f->size = size;
+    f->active = true;
+    f->pending = true;
+    return 0;
+}
+
+void followStop(struct fileFollow *f) {
+    if (!f->active) return;
+#if !defined(_WIN32) && !defined(_WIN64)
+    close(f->fd);
+    if (f->inotify != -1) close(f->inotify);
+#else
+    fclose(f->fp);
+#endif
+    free(f->path);
+    f->path = NULL;
+    f->active = false;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+/* True if inotify reported a change since the last call; always true when there is no inotify. */
+static bool followChanged(struct fileFollow *f) {
+    if (f->inotify == -1) return true;
+
+    bool changed = false;
+    char events[4096];
+    while (read(f->inotify, events, sizeof(events)) > 0) changed = true;
+    return changed;
+}
+
+/* True if the name no longer leads to the open file: it was renamed or deleted, maybe with a new file made in its place. */
+static bool followReplaced(const struct fileFollow *f, const struct stat *st) {
+    struct stat now;
+    if (stat(f->path, &now) == -1) return true;
+    return now.st_ino != st->st_ino || now.st_dev != st->st_dev;
+}
+#endif
+
+/*
+ * Copies up to `max` bytes appended since the last call into `dst`. Returns 0 when nothing is new
+ * and -1 when the file shrank, which means it was rewritten rather than appended to, or when it
+ * was replaced under its name and everything written to the old file has been read.
+ */
+long followRead(struct fileFollow *f, char *dst, size_t max) {
+    if (!f->active) return 0;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (!f->pending && !followChanged(f)) return 0;
+
+    struct stat st;
+    if (fstat(f->fd, &st) == -1) return -1;
+    size_t size = (size_t)st.st_size;
+    bool replaced = size <= f->size && followReplaced(f, &st);
+#else
+    struct _stat64 st;
+    if (_fstat64(_fileno(f->fp), &st) == -1) return -1;
+    size_t size = (size_t)st.st_size;
+    bool replaced = false;
+#endif
+
+    if (size < f->size || replaced) return -1;
+    if (size == f->size) {
+        f->pending = false;
+        return 0;
+    }
+    f->pending = true;
+
+    size_t want = size - f->size < max ? size - f->size : max;
+#if !defined(_WIN32) && !defined(_WIN64)
+    ssize_t n = pread(f->fd, dst, want, (off_t)f->size);
+    if (n == -1) return errno == EINTR ? 0 : -1;
+#else
+    if (_fseeki64(f->fp, (__int64)f->size, SEEK_SET) != 0) return -1;
+    size_t n = fread(dst, 1, want, f->fp);
+    if (n == 0 && ferror(f->fp)) return -1;
+#endif
+    f->size += (size_t)n;
+    return (long)n;
+}
@@ -0,0 +1,26 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* A file being watched for appended bytes, like `tail -f`. */
+struct fileFollow {
+    bool active;
+    bool pending;
+    size_t size;
+    char *path;
+#if !defined(_WIN32) && !defined(_WIN64)
+    int fd;
+    int inotify;
+#else
+    FILE *fp;
+#endif
+};
+
+int followStart(struct fileFollow *f, const char *filename, size_t size);
+void followStop(struct fileFollow *f);
+long followRead(struct fileFollow *f, char *dst, size_t max);
+
+#endif
@@ -0,0 +1,458 @@
+/* clock_gettime, fsync, truncate and strdup are POSIX rather than C99. */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <time.h>
+    #include <unistd.h>
+#endif
+
+#include "journal.h"
+
+/* The header is the magic followed by the base file's size, mtime and mtime nanoseconds. */
+#define JOURNAL_MAGIC "VIVAJNL1"
+#define JOURNAL_HEADER 32
+
+/* Every frame starts with the length and FNV-1a checksum of its records. */
+#define JOURNAL_FRAME_HEADER 8
+
+/* Records are written out once this many bytes pile up, without waiting for the timer. */
+#define JOURNAL_FRAME ((size_t)1 << 20)
+
+enum {
+    JOURNAL_NONE,
+    JOURNAL_INSERT,
+    JOURNAL_DELETE
+};
+
+static double journalClock() {
+#if defined(_WIN32) || defined(_WIN64)
+    return GetTickCount64() / 1000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get32(const unsigned char *p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint64_t get64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+    return v;
+}
+
+static uint32_t checksum(const unsigned char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h ^= s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Only size and mtime are compared: the inode changes with every save and the device number across reboots. */
+static bool sameBase(const struct fileStamp *a, const struct fileStamp *b) {
+    return a->size == b->size && a->mtime == b->mtime && a->mtimeNsec == b->mtimeNsec;
+}
+
+static void headerEncode(unsigned char *header, const struct fileStamp *base) {
+    memcpy(header, JOURNAL_MAGIC, 8);
+    put64(header + 8, (uint64_t)base->size);
+    put64(header + 16, (uint64_t)base->mtime);
+    put64(header + 24, (uint64_t)base->mtimeNsec);
+}
+
+/* `.name.journal` next to `name`. */
+static char *journalPath(const char *filename) {
+    const char *slash = strrchr(filename, '/');
+#if defined(_WIN32) || defined(_WIN64)
+    const char *back = strrchr(filename, '\\');
+    if (back && (!slash || back > slash)) slash = back;
+#endif
+    size_t dirLen = slash ? (size_t)(slash - filename) + 1 : 0;
+    size_t len = strlen(filename) + 10;
+    char *path = (char *)malloc(len);
+    snprintf(path, len, "%.*s.%s.journal", (int)dirLen, filename, filename + dirLen);
+    return path;
+}
+
+static int journalSync(FILE *fp) {
+#if defined(_WIN32) || defined(_WIN64)
+    return _commit(_fileno(fp));
+#else
+    return fsync(fileno(fp));
+#endif
+}
+
+static void outReserve(struct journal *j, size_t n) {
+    if (j->outLen + n <= j->outCap) return;
+    size_t cap = j->outCap ? j->outCap : 4096;
+    while (cap < j->outLen + n) cap *= 2;
+    j->out = (unsigned char *)realloc(j->out, cap);
+    j->outCap = cap;
+}
+
+static void outVarint(struct journal *j, uint64_t v) {
+    outReserve(j, 10);
+    while (v >= 0x80) {
+        j->out[j->outLen++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    j->out[j->outLen++] = (unsigned char)v;
+}
+
+static bool readVarint(const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char c = *(*p)++;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (c < 0x80) return true;
+    }
+    return false;
+}
+
+/* Walks a frame's records without applying them, so a frame is replayed whole or not at all. */
+static bool frameValid(const unsigned char *p, const unsigned char *end, size_t length) {
+    while (p < end) {
+        uint64_t head, len;
+        if (!readVarint(&p, end, &head) || !readVarint(&p, end, &len) || (head >> 1) > length) return false;
+        size_t offset = (size_t)(head >> 1);
+        if (head & 1) {
+            if (len > (uint64_t)(end - p)) return false;
+            p += len;
+            length += (size_t)len;
+        } else {
+            length -= len < length - offset ? (size_t)len : length - offset;
+        }
+    }
+    return true;
+}
+
+/* A record is the offset shifted left once with the low bit set for inserts, the length, and inserted bytes. */
+static void encodePending(struct journal *j) {
+    if (j->pendingKind == JOURNAL_NONE) return;
+    if (j->outLen == 0) {
+        outReserve(j, JOURNAL_FRAME_HEADER);
+        j->outLen = JOURNAL_FRAME_HEADER;
+    }
+    outVarint(j, (uint64_t)j->pendingOffset << 1 | (j->pendingKind == JOURNAL_INSERT));
+    outVarint(j, j->pendingLen);
+    if (j->pendingKind == JOURNAL_INSERT) {
+        outReserve(j, j->pendingLen);
+        memcpy(j->out + j->outLen, j->pendingChars, j->pendingLen);
+        j->outLen += j->pendingLen;
+    }
+    j->pendingKind = JOURNAL_NONE;
+}
+
+/* Appends the records so far as one frame, creating the file with its header on first use. */
+static int journalWrite(struct journal *j, bool sync) {
+    encodePending(j);
+    if (j->outLen == 0) return 0;
+
+    if (j->fp == NULL) {
+        /* Appending only continues a journal this session replayed or wrote; anything else there is stale. */
+        j->fp = fopen(j->path, j->length ? "ab" : "wb");
+        if (j->fp == NULL) return -1;
+    }
+    if (j->length == 0) {
+        unsigned char header[JOURNAL_HEADER];
+        headerEncode(header, &j->base);
+        if (fwrite(header, 1, sizeof(header), j->fp) != sizeof(header)) return -1;
+        j->length = JOURNAL_HEADER;
+    }
+
+    size_t payload = j->outLen - JOURNAL_FRAME_HEADER;
+    put32(j->out, (uint32_t)payload);
+    put32(j->out + 4, checksum(j->out + JOURNAL_FRAME_HEADER, payload));
+    if (fwrite(j->out, 1, j->outLen, j->fp) != j->outLen || fflush(j->fp) != 0) return -1;
+    if (sync && journalSync(j->fp) != 0) return -1;
+
+    j->length += j->outLen;
+    j->outLen = 0;
+    return 0;
+}
+
+/* Notes the start of a batch; the first edit after the buffer was clean also fixes the base. */
+static void journalBegin(struct journal *j) {
+    if (!j->stamped) {
+        if (stampGet(j->filename, &j->base) == -1) memset(&j->base, 0, sizeof(j->base));
+        j->stamped = true;
+    }
+    if (!journalPending(j)) j->since = journalClock();
+}
+
+static void pendingAppend(struct journal *j, const char *chars, size_t len) {
+    if (j->pendingLen + len > j->pendingCap) {
+        size_t cap = j->pendingCap ? j->pendingCap : 256;
+        while (cap < j->pendingLen + len) cap *= 2;
+        j->pendingChars = (char *)realloc(j->pendingChars, cap);
+        j->pendingCap = cap;
+    }
+    memcpy(j->pendingChars + j->pendingLen, chars, len);
+    j->pendingLen += len;
+}
+
+void journalInit(struct journal *j) {
+    memset(j, 0, sizeof(*j));
+}
+
+/* Journals edits to `filename` from now on; nothing is written before the first edit. */
+void journalStart(struct journal *j, const char *filename) {
+    journalFree(j);
+    j->filename = strdup(filename);
+    j->path = journalPath(filename);
+}
+
+/*
+ * Moves a journal that can't be replayed out of the way, so this session starts a fresh one and
+ * the old edits are still there to be looked at by hand.
+ */
+static void journalSetAside(const struct journal *j) {
+    size_t len = strlen(j->path) + 7;
+    char *stale = (char *)malloc(len);
+    snprintf(stale, len, "%s.stale", j->path);
+    remove(stale);
+    rename(j->path, stale);
+    free(stale);
+}
+
+/*
+ * Applies the journal left by an earlier session to the freshly opened `b`. Returns the number
+ * of edits replayed, JOURNAL_STALE when the journal belongs to another version of the file, or
+ * JOURNAL_CORRUPT when its header is cut short or unreadable; either way it is set aside. Replay
+ * stops at the first torn or corrupt frame, and the journal is cut back to the frames applied.
+ */
+long journalReplay(struct journal *j, struct textBuffer *b) {
+    if (j->path == NULL) return 0;
+    FILE *fp = fopen(j->path, "rb");
+    if (fp == NULL) return 0;
+
+    size_t size = 0, cap = 1 << 16;
+    unsigned char *data = (unsigned char *)malloc(cap);
+    size_t n;
+    while ((n = fread(data + size, 1, cap - size, fp)) > 0) {
+        size += n;
+        if (size == cap) {
+            cap *= 2;
+            data = (unsigned char *)realloc(data, cap);
+        }
+    }
+    fclose(fp);
+
+    if (size < JOURNAL_HEADER || memcmp(data, JOURNAL_MAGIC, 8) != 0) {
+        free(data);
+        journalSetAside(j);
+        return JOURNAL_CORRUPT;
+    }
+    struct fileStamp current;
+    j->base.size = (long long)get64(data + 8);
+    j->base.mtime = (long long)get64(data + 16);
+    j->base.mtimeNsec = (long long)get64(data + 24);
+    if (stampGet(j->filename, &current) == -1 || !sameBase(&j->base, &current)) {
+        free(data);
+        memset(&j->base, 0, sizeof(j->base));
+        journalSetAside(j);
+        return JOURNAL_STALE;
+    }
+    j->stamped = true;
+
+    long count = 0;
+    size_t valid = JOURNAL_HEADER;
+    while (valid + JOURNAL_FRAME_HEADER <= size) {
+        const unsigned char *p = data + valid + JOURNAL_FRAME_HEADER;
+        size_t payload = get32(data + valid);
+        if (payload > size - valid - JOURNAL_FRAME_HEADER || checksum(p, payload) != get32(data + valid + 4)) break;
+
+        const unsigned char *end = p + payload;
+        if (!frameValid(p, end, bufferLength(b))) break;
+        while (p < end) {
+            uint64_t head, len;
+            readVarint(&p, end, &head);
+            readVarint(&p, end, &len);
+            if (head & 1) {
+                bufferInsert(b, (size_t)(head >> 1), (const char *)p, (size_t)len);
+                p += len;
+            } else {
+                bufferDelete(b, (size_t)(head >> 1), (size_t)len);
+            }
+            count++;
+        }
+        valid += JOURNAL_FRAME_HEADER + payload;
+    }
+    free(data);
+
+    if (valid < size) {
+#if defined(_WIN32) || defined(_WIN64)
+        FILE *tail = fopen(j->path, "r+b");
+        if (tail) {
+            _chsize_s(_fileno(tail), (long long)valid);
+            fclose(tail);
+        }
+#else
+        if (truncate(j->path, (off_t)valid) == -1) valid = size;
+#endif
+    }
+    j->length = valid;
+    return count;
+}
+
+void journalInsert(struct journal *j, size_t offset, const char *chars, size_t len) {
+    if (j->path == NULL || len == 0) return;
+    journalBegin(j);
+
+    if (j->pendingKind != JOURNAL_INSERT || offset != j->pendingOffset + j->pendingLen) {
+        encodePending(j);
+        j->pendingKind = JOURNAL_INSERT;
+        j->pendingOffset = offset;
+        j->pendingLen = 0;
+    }
+    pendingAppend(j, chars, len);
+    if (j->outLen + j->pendingLen >= JOURNAL_FRAME) journalWrite(j, false);
+}
+
+/* Backspacing moves the start of the pending delete back, deleting forward grows it. */
+void journalDelete(struct journal *j, size_t offset, size_t len) {
+    if (j->path == NULL || len == 0) return;
+    journalBegin(j);
+
+    if (j->pendingKind == JOURNAL_DELETE && offset + len == j->pendingOffset) {
+        j->pendingOffset = offset;
+        j->pendingLen += len;
+    } else if (j->pendingKind == JOURNAL_DELETE && offset == j->pendingOffset) {
+        j->pendingLen += len;
+    } else {
+        encodePending(j);
+        j->pendingKind = JOURNAL_DELETE;
+        j->pendingOffset = offset;
+        j->pendingLen = len;
+    }
+    if (j->outLen >= JOURNAL_FRAME) journalWrite(j, false);
+}
+
+bool journalPending(const struct journal *j) {
+    return j->pendingKind != JOURNAL_NONE || j->outLen > 0;
+}
+
+/* Writes and syncs the edits of the last `interval` milliseconds; called once per frame. Returns -1 when the journal can't be written. */
+int journalTick(struct journal *j, int interval) {
+    if (!journalPending(j) || (journalClock() - j->since) * 1000 < interval) return 0;
+    return journalWrite(j, true);
+}
+
+/* Where the edits made after this point begin; a save records it so they can outlive the save. */
+size_t journalMark(struct journal *j) {
+    if (j->path == NULL) return 0;
+    journalWrite(j, false);
+    return j->length ? j->length : JOURNAL_HEADER;
+}
+
+/*
+ * After `filename` was saved from the buffer as it stood at `mark`, restarts the journal against
+ * the saved file, keeping only the edits made while the save ran. The new journal is written
+ * beside the old one and renamed over it, so a crash leaves one or the other.
+ */
+int journalRebase(struct journal *j, const char *filename, size_t mark) {
+    if (j->path == NULL) return 0;
+    int result = journalWrite(j, false);
+
+    unsigned char *tail = NULL;
+    size_t tailLen = j->length > mark ? j->length - mark : 0;
+    if (result == 0 && tailLen > 0) {
+        tail = (unsigned char *)malloc(tailLen);
+        FILE *fp = fopen(j->path, "rb");
+        if (fp == NULL || fseek(fp, (long)mark, SEEK_SET) != 0 || fread(tail, 1, tailLen, fp) != tailLen) result = -1;
+        if (fp) fclose(fp);
+    }
+    if (j->fp) {
+        fclose(j->fp);
+        j->fp = NULL;
+    }
+    if (result == -1) {
+        free(tail);
+        return -1;
+    }
+
+    char *old = j->path;
+    j->path = journalPath(filename);
+    free(j->filename);
+    j->filename = strdup(filename);
+    j->length = 0;
+    j->stamped = false;
+
+    if (tailLen > 0) {
+        if (stampGet(filename, &j->base) == -1) memset(&j->base, 0, sizeof(j->base));
+        j->stamped = true;
+
+        size_t tempLen = strlen(j->path) + 5;
+        char *temp = (char *)malloc(tempLen);
+        snprintf(temp, tempLen, "%s.new", j->path);
+        unsigned char header[JOURNAL_HEADER];
+        headerEncode(header, &j->base);
+
+        FILE *fp = fopen(temp, "wb");
+        result = fp && fwrite(header, 1, sizeof(header), fp) == sizeof(header) &&
+                 fwrite(tail, 1, tailLen, fp) == tailLen && fflush(fp) == 0 && journalSync(fp) == 0 ? 0 : -1;
+        if (fp && fclose(fp) != 0) result = -1;
+#if defined(_WIN32) || defined(_WIN64)
+        if (result == 0 && !MoveFileExA(temp, j->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) result = -1;
+#else
+        if (result == 0 && rename(temp, j->path) == -1) result = -1;
+#endif
+        if (result == -1) {
+            remove(temp);
+        } else {
+            j->length = JOURNAL_HEADER + tailLen;
+        }
+        free(temp);
+    }
+    if (tailLen == 0 || strcmp(old, j->path) != 0) remove(old);
+    free(old);
+    free(tail);
+    return result;
+}
+
+/* Forgets the edits so far, as when they are thrown away on quit. */
+void journalDiscard(struct journal *j) {
+    if (j->fp) {
+        fclose(j->fp);
+        j->fp = NULL;
+    }
+    if (j->path && j->length > 0) remove(j->path);
+    j->length = 0;
+    j->outLen = 0;
+    j->pendingKind = JOURNAL_NONE;
+    j->stamped = false;
+}
+
+/* Closes the journal and leaves its file for the next session to replay. */
+void journalFree(struct journal *j) {
+    if (j->fp) fclose(j->fp);
+    free(j->filename);
+    free(j->path);
+    free(j->out);
+    free(j->pendingChars);
+    memset(j, 0, sizeof(*j));
+}
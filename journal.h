@@ -0,0 +1,49 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "buffer.h"
+#include "reload.h"
+
+/*
+ * Unsaved edits, appended to a hidden file next to the one being edited so they outlive a crash.
+ * Edits are encoded into `out` and written as one checksummed frame per flush; `base` is the
+ * version of the file on disk the edits apply to. Runs of typing or deleting are merged into the
+ * pending record until something else happens.
+ */
+/* journalReplay's answers for a journal it could not apply; the file is set aside as `<path>.stale`. */
+#define JOURNAL_STALE (-1)
+#define JOURNAL_CORRUPT (-2)
+
+struct journal {
+    char *filename;
+    char *path;
+    FILE *fp;
+    size_t length;
+    struct fileStamp base;
+    bool stamped;
+    unsigned char *out;
+    size_t outLen, outCap;
+    int pendingKind;
+    size_t pendingOffset, pendingLen;
+    char *pendingChars;
+    size_t pendingCap;
+    double since;
+};
+
+void journalInit(struct journal *j);
+void journalStart(struct journal *j, const char *filename);
+long journalReplay(struct journal *j, struct textBuffer *b);
+void journalInsert(struct journal *j, size_t offset, const char *chars, size_t len);
+void journalDelete(struct journal *j, size_t offset, size_t len);
+bool journalPending(const struct journal *j);
+int journalTick(struct journal *j, int interval);
+size_t journalMark(struct journal *j);
+int journalRebase(struct journal *j, const char *filename, size_t mark);
+void journalDiscard(struct journal *j);
+void journalFree(struct journal *j);
+
+#endif
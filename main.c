@@ -2,6 +2,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "search.h"
+#include "save.h"
+#include "follow.h"
+#include "reload.h"
+#include "journal.h"
+#include "undo.h"
 
 #if defined(_WIN32) || defined(_WIN64)
     #include <curses.h>
@@ -10,39 +21,71 @@
 #endif
 
 #define CTRL_KEY(k) ((k) & 0x1f)
+#define MESSAGE_TIMEOUT 5
 
-struct text {
-    int index;
-    int size;
-    char *chars;
-    struct text *prev;
-    struct text *next;
-};
+/* Follow mode reads appended bytes in blocks of this size, and at most FOLLOW_FRAME of them per frame. */
+#define FOLLOW_BLOCK 65536
+#define FOLLOW_FRAME ((size_t)16 << 20)
+
+/* How often, in milliseconds, an idle editor looks for the file changing on disk. */
+#define WATCH_INTERVAL 1000
+
+/* Unsaved edits reach the journal on disk at most this many milliseconds after they are made. */
+#define JOURNAL_INTERVAL 1000
 
 struct editorConfig {
     int cx, cy;
-    int rowoff;
+    int rowoff, coloff;
     int screenRows, screenCols;
     int totalRows;
-    struct text *row;
-    struct text *currentRow;
+    struct textBuffer buf;
+    int anchorRow;
+    size_t anchorOffset;
+    unsigned long anchorVersion;
     char *filename;
+    enum compressFormat format;
     bool isSave;
+    bool readOnly;
     char message[256];
+    time_t messageTime;
+    struct saveJob saver;
+    bool saving, savePending;
+    unsigned long edits, saveEdits;
+    struct fileFollow follow;
+    struct fileWatch watch;
+    struct journal journal;
+    size_t journalMark;
+    struct undoLog undo;
+    bool *damaged;
+    int drawnRowoff, drawnColoff;
+    int drawnTotalRows;
+    bool drawnEmpty;
+    char drawnStatus[200];
+    long frameBytes;
+    bool showStats;
 };
 
 struct editorConfig E;
 
 struct searchResult {
-    struct text *row;
+    int row;
     int match_pos;
+    char query[256];
+    int queryLen;
+    bool regex;
+    struct searchPattern pattern;
+    struct matchIndex matches;
+    struct searchJob job;
+    bool recount;
 };
 
 struct searchResult S;
 
 bool search_mode = false;
-struct text *saved_currentRow;
-int saved_cx, saved_cy, saved_rowoff;
+int saved_cx, saved_cy, saved_rowoff, saved_coloff;
+
+char *row_chars = NULL;
+size_t row_cap = 0;
 
 void die(const char *s) {
     endwin();
@@ -50,18 +93,98 @@ void die(const char *s) {
     exit(1);
 }
 
+void editorDamage(int from, int to) {
+    if (from < 0) from = 0;
+    if (to > E.screenRows + 2) to = E.screenRows + 2;
+    for (int y = from; y < to; y++) {
+        E.damaged[y] = true;
+    }
+}
+
+void editorDamageAll() {
+    editorDamage(0, E.screenRows + 2);
+    E.drawnStatus[0] = '\0';
+}
+
+void editorResizeDamage() {
+    E.damaged = (bool *)realloc(E.damaged, (E.screenRows + 2) * sizeof(bool));
+    editorDamageAll();
+    wsetscrreg(stdscr, 0, E.screenRows - 1);
+}
+
+/* Shifts the text rows already on screen by `shift` lines; only the exposed rows are left to repaint. */
+void editorScrollRegion(int shift) {
+    scrollok(stdscr, TRUE);
+    wscrl(stdscr, shift);
+    scrollok(stdscr, FALSE);
+
+    if (shift > 0) {
+        memmove(&E.damaged[0], &E.damaged[shift], (E.screenRows - shift) * sizeof(bool));
+        editorDamage(E.screenRows - shift, E.screenRows);
+    } else {
+        memmove(&E.damaged[-shift], &E.damaged[0], (E.screenRows + shift) * sizeof(bool));
+        editorDamage(0, -shift);
+    }
+}
+
+/*
+ * Bytes this thread has passed to write(2) so far, from the kernel's count; -1 where there is none.
+ * ncurses writes straight to the terminal's descriptor, so no stream handed to newterm sees its
+ * output. The stat shows this count around the drawing instead, which is what the terminal got
+ * unless something else wrote in between, and is labeled as write bytes for that reason.
+ */
+long editorBytesWritten() {
+#if defined(__linux__)
+    FILE *fp = fopen("/proc/thread-self/io", "r");
+    if (!fp) return -1;
+
+    char line[64];
+    long bytes = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "wchar: %ld", &bytes) == 1) break;
+    }
+    fclose(fp);
+    return bytes;
+#else
+    return -1;
+#endif
+}
+
+void editorSetMessage(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(E.message, sizeof(E.message), fmt, ap);
+    va_end(ap);
+    E.messageTime = time(NULL);
+    editorDamage(E.screenRows + 1, E.screenRows + 2);
+}
+
 void initEditor() {
     E.cx = 0;
     E.cy = 0;
     E.rowoff = 0;
-    E.totalRows = 0;
-    E.row = NULL;
-    E.currentRow = NULL;
+    E.coloff = 0;
+    bufferInit(&E.buf);
+    E.totalRows = (int)bufferLineCount(&E.buf);
+    E.anchorRow = -1;
     E.filename = NULL;
+    E.format = COMPRESS_NONE;
     E.isSave = false;
+    E.readOnly = false;
+    journalInit(&E.journal);
+    undoInit(&E.undo, UNDO_LIMIT);
     getmaxyx(stdscr, E.screenRows, E.screenCols);
     E.screenRows -= 2;
-    scrollok(stdscr, TRUE);
+    idlok(stdscr, TRUE);
+
+    E.damaged = NULL;
+    E.drawnRowoff = 0;
+    E.drawnColoff = 0;
+    E.drawnTotalRows = E.totalRows;
+    E.drawnEmpty = true;
+    E.frameBytes = -1;
+    E.showStats = getenv("VIVA_STATS") != NULL;
+    editorResizeDamage();
 }
 
 void initColors() {
@@ -72,15 +195,40 @@ void initColors() {
     use_default_colors();
 }
 
-void updateLineIndexes() {
-    struct text *row = E.row;
-    int idx = 0;
-    while (row) {
-        row->index = idx++;
-        row = row->next;
+int editorRowSize(int row) {
+    return (int)bufferLineSize(&E.buf, row);
+}
+
+size_t editorRowOffset(int row, int col) {
+    return bufferLineStart(&E.buf, row) + col;
+}
+
+void editorSync(bool wait) {
+    bufferSync(&E.buf, wait);
+    E.totalRows = (int)bufferLineCount(&E.buf);
+    if (wait && E.cx > editorRowSize(E.cy)) {
+        E.cx = editorRowSize(E.cy);
     }
 }
 
+void editorReserveRow(size_t len) {
+    if (len <= row_cap) return;
+
+    size_t cap = row_cap ? row_cap : 128;
+    while (cap < len) cap *= 2;
+    row_chars = (char *)realloc(row_chars, cap);
+    row_cap = cap;
+}
+
+char *editorRowChars(int row, int *size) {
+    size_t len = bufferLineSize(&E.buf, row);
+    editorReserveRow(len + 1);
+    bufferRead(&E.buf, bufferLineStart(&E.buf, row), row_chars, len);
+    row_chars[len] = '\0';
+    if (size) *size = (int)len;
+    return row_chars;
+}
+
 void editorScroll() {
     if (E.cy < E.rowoff) {
         E.rowoff = E.cy;
@@ -88,250 +236,510 @@ void editorScroll() {
     if (E.cy >= E.rowoff + E.screenRows) {
         E.rowoff = E.cy - E.screenRows + 1;
     }
+    if (E.cx < E.coloff) {
+        E.coloff = E.cx;
+    }
+    if (E.cx >= E.coloff + E.screenCols) {
+        E.coloff = E.cx - E.screenCols + 1;
+    }
 }
 
-void editorAppendRow(const char *s, size_t len) {
-    struct text *new_row = (struct text *)malloc(sizeof(struct text));
-    new_row->size = len;
-    new_row->chars = (char *)malloc(len + 1);
-    memcpy(new_row->chars, s, len);
-    new_row->chars[len] = '\0';
-    new_row->index = E.totalRows;
-    new_row->prev = NULL;
-    new_row->next = NULL;
+/* Replays the edits a session that died before saving left in the journal of `filename`. */
+void editorRecover(const char *filename) {
+    journalStart(&E.journal, filename);
+    long replayed = journalReplay(&E.journal, &E.buf);
+    if (replayed == JOURNAL_STALE || replayed == JOURNAL_CORRUPT) {
+        /* The journal stays started, so this session's edits are protected by a fresh one. */
+        if (replayed == JOURNAL_STALE) {
+            editorSetMessage("%s is from another version of %s; kept as %s.stale", E.journal.path, filename, E.journal.path);
+        } else {
+            editorSetMessage("%s is damaged; kept as %s.stale", E.journal.path, E.journal.path);
+        }
+        return;
+    }
+    if (replayed > 0) {
+        E.edits++;
+        E.isSave = true;
+        E.totalRows = (int)bufferLineCount(&E.buf);
+        editorSetMessage("Recovered %ld unsaved edit%s of %s", replayed, replayed == 1 ? "" : "s", filename);
+    }
+}
+
+void editorOpen(const char *filename) {
+    free(E.filename);
+    E.filename = strdup(filename);
+
+    /* A file bigger than memory could never be saved from it, so it is only viewed. */
+    if (sourceExceedsMemory(filename)) E.readOnly = true;
 
-    if (E.row == NULL) {
-        E.row = new_row;
-        E.currentRow = new_row;
+    if (bufferOpen(&E.buf, filename, E.screenRows, E.readOnly) == -1) die("open");
+    /* Saving keeps the file in the format it was found in, whatever its name says. */
+    E.format = E.buf.original.format;
+    E.totalRows = (int)bufferLineCount(&E.buf);
+    watchStart(&E.watch, filename);
+    E.isSave = false;
+    if (E.readOnly) {
+        editorSetMessage("Opened file %s read-only", filename);
+    } else if (E.buf.original.format != COMPRESS_NONE) {
+        editorSetMessage("Opened file %s (%s)", filename, compressName(E.buf.original.format));
     } else {
-        struct text *last_row = E.row;
-        while (last_row->next) last_row = last_row->next;
-        last_row->next = new_row;
-        new_row->prev = last_row;
+        editorSetMessage("Opened file %s", filename);
     }
-    E.totalRows++;
+    if (!E.readOnly) editorRecover(filename);
 }
 
-ssize_t window_getline(char **lineptr, size_t *n, FILE *stream) {
-    if (!lineptr || !n || !stream) return -1;
-
-    char *buf = *lineptr;
-    size_t size = *n;
-    int c;
-    size_t i = 0;
+void editorSaveStart() {
+    E.saveEdits = E.edits;
+    E.journalMark = journalMark(&E.journal);
+    E.saving = true;
+    saveStart(&E.saver, &E.buf, E.filename, E.format);
+}
 
-    if (buf == NULL || size == 0) {
-        size = 128;
-        buf = realloc(buf, size);
-        if (!buf) return -1;
-        *lineptr = buf;
-        *n = size;
+/* Follows the background save started by editorSave; called once per frame. */
+void editorSaveProgress() {
+    if (!E.saving) return;
+    if (saveRunning(&E.saver)) {
+        editorSetMessage("Saving %s... %d%%", E.saver.filename, saveProgress(&E.saver));
+        return;
     }
+    E.saving = false;
 
-    while ((c = fgetc(stream)) != EOF) {
-        if (i >= size - 1) {
-            size *= 2;
-            buf = realloc(buf, size);
-            if (!buf) return -1;
-            *lineptr = buf;
-            *n = size;
+    if (E.saver.result == -1) {
+        editorSetMessage("Can't save %s: %s", E.saver.filename, strerror(E.saver.error));
+    } else {
+        if (E.edits == E.saveEdits) E.isSave = false;
+        if (E.journal.path == NULL) journalStart(&E.journal, E.saver.filename);
+        if (journalRebase(&E.journal, E.saver.filename, E.journalMark) == -1) {
+            editorSetMessage("Can't update journal %s: %s", E.journal.path, strerror(errno));
+        }
+        if (E.watch.active) {
+            watchReset(&E.watch, E.saver.filename);
+        } else {
+            watchStart(&E.watch, E.saver.filename);
+        }
+        /* The rename left the followed descriptor on the old inode; pick up the new file where the save ended. */
+        if (E.follow.active) {
+            followStop(&E.follow);
+            followStart(&E.follow, E.saver.filename, E.saver.total);
         }
-        buf[i++] = (char)c;
-        if (c == '\n') break;
-    }
 
-    if (i == 0) return -1;
+        struct saveStats *stats = &E.saver.stats;
+        bool large = stats->bytes >= 1024 * 1024;
+        double rate = stats->seconds > 0 ? stats->bytes / (1024.0 * 1024.0) / stats->seconds : 0;
+        editorSetMessage("Saved %s: %.1f %s in %.3fs (%.1f MB/s)", E.saver.filename,
+                         stats->bytes / (large ? 1024.0 * 1024.0 : 1024.0), large ? "MB" : "KB", stats->seconds, rate);
+    }
 
-    buf[i] = '\0';
-    return i;
+    if (E.savePending) {
+        E.savePending = false;
+        editorSaveStart();
+    }
 }
 
-void editorOpen(const char *filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
-
-   FILE *fp = fopen(filename, "r");
-    if (!fp) die("fopen");
-
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+/* Reads a line typed after `prompt` on the message bar into `buf`; NULL when Escape cancels it. */
+char *editorPrompt(const char *prompt, char *buf, int size) {
+    char *answer = NULL;
+    int len = 0;
+    buf[0] = '\0';
+    for (;;) {
+        mvhline(E.screenRows + 1, 0, ' ', E.screenCols);
+        mvprintw(E.screenRows + 1, 0, "%s%s", prompt, buf);
+        refresh();
 
-    #if defined(_WIN32) || defined(_WIN64)
-        while ((linelen = window_getline(&line, &linecap, fp)) != -1) {
-    #else
-        while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    #endif
-        while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-            linelen--;
-        editorAppendRow(line, linelen);
+        int c = getch();
+        if (c == 27) break;
+        if (c == '\r' || c == '\n') {
+            answer = buf;
+            break;
+        }
+        if (c == '\b' || c == 127 || c == KEY_BACKSPACE) {
+            if (len > 0) buf[--len] = '\0';
+        } else if (((c >= 32 && c <= 126) || (c >= 192 && c <= 255)) && len < size - 1) {
+            buf[len++] = (char)c;
+            buf[len] = '\0';
+        }
     }
+    editorDamage(E.screenRows + 1, E.screenRows + 2);
+    return answer;
+}
 
-    free(line);
-    fclose(fp);
-    E.isSave = false;
-    snprintf(E.message, sizeof(E.message), "Opened file %s", filename);
+/* Read-only files keep a sparse line index that edits could not maintain, so every edit asks here first. */
+bool editorWritable() {
+    if (E.readOnly) editorSetMessage("%s is open read-only", E.filename);
+    return !E.readOnly;
 }
 
 void editorSave() {
+    if (!editorWritable()) return;
     if (E.filename == NULL) {
         char filename[256];
-        mvhline(E.screenRows + 1, 0, ' ', E.screenCols);
-        mvprintw(E.screenRows + 1, 0, "Save as: ");
-        echo();
-        getnstr(filename, sizeof(filename) - 1);
-        noecho();
+        if (!editorPrompt("Save as: ", filename, sizeof(filename)) || filename[0] == '\0') {
+            editorSetMessage("Save aborted");
+            return;
+        }
         E.filename = strdup(filename);
+        E.format = compressFormatFor(filename);
     }
 
-    FILE *fp = fopen(E.filename, "w");
-    if (!fp) die("fopen");
+    if (E.saving) {
+        E.savePending = true;
+        return;
+    }
+    editorSaveStart();
+}
+
+/* Every edit goes through here so state derived from the text follows it. Edits that leave the buffer unsaved are journaled. */
+void editorApplyInsert(size_t offset, const char *s, size_t len) {
+    searchJobStop(&S.job);
+    S.recount = S.pattern.len > 0;
+    bufferInsert(&E.buf, offset, s, len);
+    if (E.isSave) journalInsert(&E.journal, offset, s, len);
+    E.edits++;
+    matchIndexEdit(&S.matches, &S.pattern, &E.buf, offset, 0, len);
+}
+
+void editorApplyDelete(size_t offset, size_t len) {
+    searchJobStop(&S.job);
+    S.recount = S.pattern.len > 0;
+    bufferDelete(&E.buf, offset, len);
+    if (E.isSave) journalDelete(&E.journal, offset, len);
+    E.edits++;
+    matchIndexEdit(&S.matches, &S.pattern, &E.buf, offset, len, 0);
+}
 
-    struct text *row = E.row;
-    while (row) {
-        fwrite(row->chars, 1, row->size, fp);
-        fwrite("\n", 1, 1, fp);
-        row = row->next;
+/*
+ * Replaces the sorted, disjoint ranges [starts[i], ends[i]) in one rebuild of the buffer: each
+ * with all `len` bytes of `s`, or when `lens` is given, with the next lens[i] bytes of it.
+ */
+void editorApplyReplace(const size_t *starts, const size_t *ends, size_t count, const char *s, size_t len,
+                        const size_t *lens) {
+    searchJobStop(&S.job);
+    S.recount = S.pattern.len > 0;
+    if (lens) {
+        bufferReplaceEach(&E.buf, starts, ends, count, s, lens);
+    } else {
+        bufferReplace(&E.buf, starts, ends, count, s, len);
     }
-    fclose(fp);
-    E.isSave = false;
-    snprintf(E.message, sizeof(E.message), "Saved to %s", E.filename);
+    if (E.isSave) {
+        /* Journaled as the edits it stands for, at their offsets once the earlier ranges were replaced. */
+        size_t removed = 0, added = 0;
+        const char *chars = s;
+        for (size_t i = 0; i < count; i++) {
+            size_t n = lens ? lens[i] : len;
+            size_t offset = starts[i] - removed + added;
+            journalDelete(&E.journal, offset, ends[i] - starts[i]);
+            journalInsert(&E.journal, offset, chars, n);
+            removed += ends[i] - starts[i];
+            added += n;
+            if (lens) chars += n;
+        }
+    }
+    E.edits++;
 }
 
-void editorInsertNewline() {
-    if (E.currentRow == NULL) {
-        editorAppendRow("", 0);
+/*
+ * Followed bytes are appended only while the buffer matches the file, so they stay out of the
+ * undo log and the journal; an edit that makes the buffer differ stops following first.
+ */
+void editorStopFollowForEdit() {
+    if (!E.follow.active) return;
+    followStop(&E.follow);
+    watchReset(&E.watch, E.filename);
+    editorSetMessage("Stopped following %s: the buffer has unsaved changes", E.filename);
+}
+
+/* Edits made in the editor are also recorded for undo; undo and redo apply theirs directly. */
+void editorBufferInsert(size_t offset, const char *s, size_t len) {
+    editorStopFollowForEdit();
+    undoInsert(&E.undo, offset, s, len);
+    editorApplyInsert(offset, s, len);
+}
+
+void editorBufferDelete(size_t offset, size_t len) {
+    editorStopFollowForEdit();
+    undoDelete(&E.undo, &E.buf, offset, len);
+    editorApplyDelete(offset, len);
+}
+
+void editorBufferReplace(const size_t *starts, const size_t *ends, size_t count, const char *s, size_t len) {
+    editorStopFollowForEdit();
+    undoReplace(&E.undo, &E.buf, starts, ends, count, s, len);
+    editorApplyReplace(starts, ends, count, s, len, NULL);
+}
+
+/*
+ * Takes back the last step of the undo log, or with `forward` makes the next undone one again,
+ * and puts the cursor where the text changed.
+ */
+void editorUndo(bool forward) {
+    if (!editorWritable()) return;
+    editorSync(true);
+
+    size_t first, count;
+    if (!(forward ? undoForward(&E.undo, &first, &count) : undoBack(&E.undo, &first, &count))) {
+        editorSetMessage(forward ? "Nothing to redo" : "Nothing to undo");
+        return;
+    }
+
+    const struct undoLog *u = &E.undo;
+    editorStopFollowForEdit();
+    E.isSave = true;
+    if (u->records[first].flags & UNDO_REPLACE) {
+        size_t *starts, *ends, *lens;
+        char *text;
+        size_t n = undoReplaceRanges(u, first, count, forward, &starts, &ends, &text, &lens);
+        editorApplyReplace(starts, ends, n, text, 0, lens);
+        free(starts);
+        free(ends);
+        free(text);
+        free(lens);
+    } else {
+        for (size_t k = 0; k < count; k++) {
+            const struct undoRecord *r = &u->records[forward ? first + k : first + count - 1 - k];
+            if ((r->kind == UNDO_INSERT) == forward) {
+                editorApplyInsert(r->offset, u->text + r->text, r->length);
+            } else {
+                editorApplyDelete(r->offset, r->length);
+            }
+        }
+    }
+
+    const struct undoRecord *r = &u->records[first];
+    size_t offset = r->offset + ((r->kind == UNDO_INSERT) == forward ? r->length : 0);
+    E.totalRows = (int)bufferLineCount(&E.buf);
+    E.cy = (int)bufferLineOf(&E.buf, offset);
+    E.cx = (int)(offset - bufferLineStart(&E.buf, E.cy));
+    editorScroll();
+    editorDamage(0, E.screenRows);
+}
+
+/* Appends whatever was written to the followed file since the last frame, like `tail -f`. */
+void editorFollow() {
+    static char block[FOLLOW_BLOCK];
+    size_t taken = 0;
+    bool atEnd = false;
+    long n = 0;
+
+    while (taken < FOLLOW_FRAME && (n = followRead(&E.follow, block, sizeof(block))) > 0) {
+        if (taken == 0) {
+            editorSync(true);
+            atEnd = E.cy >= E.totalRows - 1;
+            editorDamage(E.totalRows - 1 - E.drawnRowoff, E.screenRows);
+        }
+        /* Bytes that are in the file are not an edit, so there is nothing to undo. */
+        editorApplyInsert(bufferLength(&E.buf), block, (size_t)n);
+        taken += (size_t)n;
+    }
+    if (n == -1) {
+        followStop(&E.follow);
+        editorSetMessage("%s was truncated or replaced; stopped following", E.filename);
+    }
+    if (taken == 0) return;
+
+    E.totalRows = (int)bufferLineCount(&E.buf);
+    if (atEnd && E.cy != E.totalRows - 1) {
+        E.cy = E.totalRows - 1;
+        E.cx = 0;
+        editorScroll();
+    }
+}
+
+void editorToggleFollow() {
+    if (E.follow.active) {
+        followStop(&E.follow);
+        watchReset(&E.watch, E.filename);
+        editorSetMessage("Stopped following %s", E.filename);
         return;
     }
+    if (E.filename == NULL || E.isSave) {
+        editorSetMessage(E.filename ? "Save changes before following" : "No file to follow");
+        return;
+    }
+    if (!editorWritable()) return;
+    if (E.buf.original.format != COMPRESS_NONE) {
+        editorSetMessage("Can't follow a %s compressed file", compressName(E.buf.original.format));
+        return;
+    }
+    if (followStart(&E.follow, E.filename, bufferLength(&E.buf)) == -1) {
+        editorSetMessage("Can't follow %s: %s", E.filename, strerror(errno));
+        return;
+    }
+    editorSetMessage("Following %s", E.filename);
+}
 
-    struct text *row = E.currentRow;
+/*
+ * Brings a clean buffer up to date with a file another process rewrote. Only the changed stretches
+ * are edited, so the cursor, scroll position and line index of the rest survive. A mapped file
+ * rewritten in place, a compressed file, or one that changed almost entirely, is opened again instead.
+ */
+void editorReload() {
+    editorSync(true);
+    searchJobStop(&S.job);
+
+    struct reloadFile f;
+    struct reloadEdit *edits = NULL;
+    size_t count = 0, inserted = 0;
+    bool incremental = !E.readOnly && E.buf.original.format == COMPRESS_NONE &&
+                       !(E.buf.original.mapped && watchSameFile(&E.watch)) &&
+                       reloadRead(&f, E.filename) == 0;
+    if (incremental) {
+        count = reloadDiff(&E.buf, &f, &edits);
+        for (size_t i = 0; i < count; i++) inserted += edits[i].inserted;
+        if (inserted > f.size / 2) {
+            incremental = false;
+            free(edits);
+            reloadClose(&f);
+        }
+    }
 
-    int new_line_length = row->size - E.cx;
-    char *new_line_content = (char *)malloc(new_line_length + 1);
+    if (incremental) {
+        /* The file's own changes are not the user's edits, so they are not recorded for undo. */
+        for (size_t i = count; i-- > 0;) {
+            if (edits[i].removed) editorApplyDelete(edits[i].offset, edits[i].removed);
+            if (edits[i].inserted) editorApplyInsert(edits[i].offset, edits[i].chars, edits[i].inserted);
+        }
+        free(edits);
+        reloadClose(&f);
+        editorSetMessage("Reloaded %s: %zu changed region%s, %zu bytes read in", E.filename, count,
+                         count == 1 ? "" : "s", inserted);
+    } else {
+        bufferFree(&E.buf);
+        bufferInit(&E.buf);
+        if (bufferOpen(&E.buf, E.filename, E.rowoff + E.screenRows, E.readOnly) == -1) {
+            editorSetMessage("Can't reload %s: %s", E.filename, strerror(errno));
+        } else {
+            E.format = E.buf.original.format;
+            editorSetMessage("Reloaded %s", E.filename);
+        }
+        E.edits++;
+        S.matches.valid = false;
+        S.recount = S.pattern.len > 0;
+        E.anchorRow = -1;
+        watchStart(&E.watch, E.filename);
+    }
+    /* The history's offsets were into the text before the reload, so it can't be taken back past it. */
+    undoClear(&E.undo);
 
-    memcpy(new_line_content, &row->chars[E.cx], new_line_length);
-    new_line_content[new_line_length] = '\0';
+    E.totalRows = (int)bufferLineCount(&E.buf);
+    if (E.cy >= E.totalRows) E.cy = E.totalRows - 1;
+    if (E.cx > editorRowSize(E.cy)) E.cx = editorRowSize(E.cy);
+    editorScroll();
+    editorDamage(0, E.screenRows);
+}
 
-    row->chars[E.cx] = '\0';
-    row->size = E.cx;
+/* Looks for the file having been rewritten by someone else; called once per frame. */
+void editorWatch() {
+    if (E.saving || E.follow.active || !watchChanged(&E.watch, E.filename)) return;
 
-    struct text *new_row = (struct text *)malloc(sizeof(struct text));
-    new_row->size = new_line_length;
-    new_row->chars = new_line_content;
-    new_row->next = row->next;
-    new_row->prev = row;
-    new_row->size = E.totalRows + 1;
+    if (E.isSave) {
+        editorSetMessage("%s changed on disk; saving will overwrite it", E.filename);
+        return;
+    }
+    editorReload();
+}
 
-    if (row->next) {
-        row->next->prev = new_row;
+/* Puts the edits of the last JOURNAL_INTERVAL on disk; called once per frame. */
+void editorJournal() {
+    if (journalTick(&E.journal, JOURNAL_INTERVAL) == -1) {
+        editorSetMessage("Can't write journal %s: %s; edits are no longer journaled", E.journal.path, strerror(errno));
+        journalFree(&E.journal);
     }
-    row->next = new_row;
+}
+
+void editorInsertNewline() {
+    if (!editorWritable()) return;
+    editorSync(true);
+    const char *newline = E.buf.crlf ? "\r\n" : "\n";
+
+    editorDamage(E.cy - E.rowoff, E.screenRows);
 
-    E.currentRow = new_row;
-    E.totalRows++;
+    /* A line break is a step of its own, apart from the typing on either side. */
+    E.isSave = true;
+    undoBreak(&E.undo);
+    editorBufferInsert(editorRowOffset(E.cy, E.cx), newline, strlen(newline));
+    undoBreak(&E.undo);
+
+    E.totalRows = (int)bufferLineCount(&E.buf);
     E.cx = 0;
     E.cy++;
-    E.isSave = true;
 
-    updateLineIndexes();
     editorScroll();
 }
 
 void editorInsertChar(int c) {
-    if (E.currentRow == NULL) {
-        editorAppendRow("", 0);
-    }
     if (!((c >= 32 && c <= 126) || (c >= 192 && c <= 255)))
         return;
+    if (!editorWritable()) return;
 
-    struct text *row = E.currentRow;
+    editorSync(true);
+    char ch = (char)c;
 
-    row->chars = (char *)realloc(row->chars, row->size + 2);
-    memmove(&row->chars[E.cx + 1], &row->chars[E.cx], row->size - E.cx + 1);
-    row->chars[E.cx] = c;
-    row->size++;
-    E.cx++;
+    editorDamage(E.cy - E.rowoff, E.cy - E.rowoff + 1);
     E.isSave = true;
+    editorBufferInsert(editorRowOffset(E.cy, E.cx), &ch, 1);
+    E.cx++;
 
-    if (E.cx >= E.screenCols) {
-        editorInsertNewline();
-    }
     editorScroll();
 }
 
 void editorDelChar() {
-    if (E.currentRow == NULL) return;
-
-    struct text *row = E.currentRow;
-
+    if (!editorWritable()) return;
+    editorSync(true);
     if (E.cx == 0) {
-        if (row->prev) {
-            struct text *prev_row = row->prev;
+        if (E.cy > 0) {
+            size_t prev_end = editorRowOffset(E.cy - 1, editorRowSize(E.cy - 1));
+            size_t row_start = bufferLineStart(&E.buf, E.cy);
 
             E.cy--;
-            E.cx = prev_row->size;
-
-            prev_row->chars = realloc(prev_row->chars, prev_row->size + row->size + 1);
-            memcpy(&prev_row->chars[prev_row->size], row->chars, row->size);
-            prev_row->size += row->size;
-            prev_row->chars[prev_row->size] = '\0';
-
-            if (row->next) {
-                row->next->prev = prev_row;
-            }
-            prev_row->next = row->next;
-
-            free(row->chars);
-            free(row);
+            E.cx = editorRowSize(E.cy);
 
-            E.currentRow = prev_row;
-            E.totalRows--;
+            editorDamage(E.cy - E.rowoff, E.screenRows);
             E.isSave = true;
+            editorBufferDelete(prev_end, row_start - prev_end);
+
+            E.totalRows = (int)bufferLineCount(&E.buf);
         }
     } else {
-        memmove(&row->chars[E.cx - 1], &row->chars[E.cx], row->size - E.cx);
-        row->size--;
-        E.cx--;
+        editorDamage(E.cy - E.rowoff, E.cy - E.rowoff + 1);
         E.isSave = true;
+        editorBufferDelete(editorRowOffset(E.cy, E.cx - 1), 1);
+        E.cx--;
     }
-    updateLineIndexes();
+    editorScroll();
 }
 
 void editorMoveCursor(int key) {
+    undoBreak(&E.undo);
     switch (key) {
         case KEY_LEFT:
             if (E.cx > 0) {
                 E.cx--;
-            } else if (E.currentRow->prev) {
-                E.currentRow = E.currentRow->prev;
+            } else if (E.cy > 0) {
                 E.cy--;
-                E.cx = E.currentRow->size;
+                E.cx = editorRowSize(E.cy);
             }
             break;
         case KEY_RIGHT:
-            if (E.cx < E.currentRow->size) {
+            if (E.cx < editorRowSize(E.cy)) {
                 E.cx++;
-            } else if (E.currentRow->next) {
-                E.currentRow = E.currentRow->next;
+            } else if (E.cy < E.totalRows - 1) {
                 E.cy++;
                 E.cx = 0;
             }
             break;
         case KEY_UP:
-            if (E.currentRow->prev) {
-                E.currentRow = E.currentRow->prev;
+            if (E.cy > 0) {
                 E.cy--;
-                if (E.cx > E.currentRow->size) {
-                    E.cx = E.currentRow->size;
+                if (E.cx > editorRowSize(E.cy)) {
+                    E.cx = editorRowSize(E.cy);
                 }
             }
             break;
         case KEY_DOWN:
-            if (E.currentRow->next) {
-                E.currentRow = E.currentRow->next;
+            if (E.cy < E.totalRows - 1) {
                 E.cy++;
-                if (E.cx > E.currentRow->size) {
-                    E.cx = E.currentRow->size;
+                if (E.cx > editorRowSize(E.cy)) {
+                    E.cx = editorRowSize(E.cy);
                 }
             }
             break;
@@ -339,40 +747,87 @@ void editorMoveCursor(int key) {
             E.cx = 0;
             break;
         case KEY_END:
-            E.cx = E.currentRow->size;
+            E.cx = editorRowSize(E.cy);
             break;
         case KEY_PPAGE:
-            for (int i = 0; i < E.screenRows; i++) {
-                if (E.currentRow->prev) {
-                    E.currentRow = E.currentRow->prev;
-                    E.cy--;
-                }
-            }
+            E.cy -= E.screenRows;
             if (E.cy < 0) E.cy = 0;
-            if (E.cx > E.currentRow->size) E.cx = E.currentRow->size;
+            if (E.cx > editorRowSize(E.cy)) E.cx = editorRowSize(E.cy);
             break;
         case KEY_NPAGE:
-            for (int i = 0; i < E.screenRows; i++) {
-                if (E.currentRow->next) {
-                    E.currentRow = E.currentRow->next;
-                    E.cy++;
-                }
-            }
+            E.cy += E.screenRows;
             if (E.cy >= E.totalRows) E.cy = E.totalRows - 1;
-            if (E.cx > E.currentRow->size) E.cx = E.currentRow->size;
+            if (E.cx > editorRowSize(E.cy)) E.cx = editorRowSize(E.cy);
             break;
     }
 
     editorScroll();
 }
 
+/*
+ * Paints the matches on screen line `y`, whose visible text starting at document offset `start` is
+ * in `chars`; `lineEnd` says the line ends within them.
+ */
+void editorHighlightMatch(int y, size_t start, const char *chars, int len, bool lineEnd) {
+    int fileRow = y + E.rowoff;
+    bool lineStart = E.coloff == 0;
+    bool indexed = matchIndexReady(&S.matches, &E.buf) && start + len <= S.matches.covered;
+    size_t i = indexed ? matchIndexLower(&S.matches, start) : 0;
+    size_t match_len = 0;
+    const char *match = indexed ? NULL : searchText(&S.pattern, chars, len, lineStart, lineEnd, &match_len);
+
+    while (indexed ? i < S.matches.count && S.matches.hits[i] < start + len : match != NULL) {
+        int match_pos = indexed ? (int)(S.matches.hits[i++] - start) : (int)(match - chars);
+        if (match_pos >= E.screenCols) break;
+        if (indexed) {
+            match_len = searchLength(&S.pattern, chars + match_pos, len - match_pos, lineStart && match_pos == 0, lineEnd);
+        }
+
+        int visible = (int)match_len < E.screenCols - match_pos ? (int)match_len : E.screenCols - match_pos;
+        if (fileRow == S.row && match_pos + E.coloff == S.match_pos) {
+            attron(COLOR_PAIR(2));
+            mvaddnstr(y, match_pos, chars + match_pos, visible);
+            attroff(COLOR_PAIR(2));
+        } else {
+            attron(COLOR_PAIR(1));
+            mvaddnstr(y, match_pos, chars + match_pos, visible);
+            attroff(COLOR_PAIR(1));
+        }
+        if (!indexed) {
+            /* Plain text matches may overlap; a regular expression picks up after the end of the last match. */
+            int next = match_pos + (S.pattern.re && match_len > 0 ? (int)match_len : 1);
+            match = searchText(&S.pattern, chars + next, len - next, false, lineEnd, &match_len);
+        }
+    }
+}
+
 void editorRows() {
-    struct text *current = E.row;
+    bool empty = bufferLength(&E.buf) == 0;
+
+    /* In search mode a little past the right edge is read so matches cut off by it are still found. */
+    int extra = search_mode ? (int)searchReach(&S.pattern) : 0;
+    editorReserveRow(E.screenCols + extra + 1);
+    char *line = row_chars;
+
+    if (E.anchorRow != E.rowoff || E.anchorVersion != E.buf.version) {
+        E.anchorRow = E.rowoff;
+        E.anchorOffset = bufferLineStart(&E.buf, E.rowoff);
+        E.anchorVersion = E.buf.version;
+    }
+    struct bufferIter it;
+    bufferIterSeek(&it, &E.buf, E.anchorOffset);
 
     for (int y = 0; y < E.screenRows; y++) {
         int fileRow = y + E.rowoff;
-        if (fileRow >= E.totalRows) {
-            if (E.totalRows == 0 && y == E.screenRows / 2) {
+        if (!E.damaged[y]) {
+            if (fileRow < E.totalRows && !empty) bufferIterLine(&it, 0, line, 0);
+            continue;
+        }
+
+        move(y, 0);
+        clrtoeol();
+        if (fileRow >= E.totalRows || empty) {
+            if (empty && y == E.screenRows / 2) {
                 char welcome[80];
                 int welcomelen = snprintf(welcome, sizeof(welcome), "Visual Text editor -- version 0.0.1");
                 if (welcomelen > E.screenCols) welcomelen = E.screenCols;
@@ -386,24 +841,11 @@ void editorRows() {
                 mvaddch(y, 0, '~');
             }
         } else {
-            current = E.row;
-            for (int i = 0; i < fileRow; i++) {
-                if (current->next) {
-                    current = current->next;
-                } else {
-                    break;
-                }
-            }
-
-            int len = current ? current->size : 0;
-            if (len > E.screenCols) {
-                len = E.screenCols;
-            }
-            if (current && current->chars) {
-                mvaddnstr(y, 0, current->chars, len);
-            } else {
-                mvaddch(y, 0, '~');
-            }
+            /* Only the columns in view are read, however long the line. */
+            size_t start = it.offset + E.coloff;
+            int len = (int)bufferIterLine(&it, E.coloff, line, E.screenCols + extra);
+            mvaddnstr(y, 0, line, len < E.screenCols ? len : E.screenCols);
+            if (search_mode && S.pattern.len > 0) editorHighlightMatch(y, start, line, len, len < E.screenCols + extra);
         }
     }
 }
@@ -412,11 +854,42 @@ void editorStatusBar() {
     attron(A_REVERSE);
     char *ext = strrchr(E.filename ? E.filename : "", '.');
 
-    char leftStatus[40];
-    snprintf(leftStatus, sizeof(leftStatus), " %s - %d lines", E.filename ? E.filename : "[No Name]", E.totalRows);
+    char hits[48] = "";
+    if (search_mode && S.pattern.len > 0 && S.job.running) {
+        snprintf(hits, sizeof(hits), " | %zu hits (searching %d%%)", S.job.hitCount, searchJobProgress(&S.job));
+    } else if (search_mode && S.pattern.len > 0) {
+        snprintf(hits, sizeof(hits), " | %zu hits", S.job.hitCount);
+    }
+
+    char leftStatus[128];
+    const char *name = E.filename ? E.filename : "[No Name]";
+    const char *ro = E.readOnly ? " [RO]" : "";
+    if (bufferIndexing(&E.buf)) {
+        snprintf(leftStatus, sizeof(leftStatus), " %s%s - %d lines (indexing %d%%)%s",
+                 name, ro, E.totalRows, bufferIndexProgress(&E.buf), hits);
+    } else {
+        snprintf(leftStatus, sizeof(leftStatus), " %s%s - %d lines%s", name, ro, E.totalRows, hits);
+    }
 
-    char rightStatus[40];
-    int rightLen = snprintf(rightStatus, sizeof(rightStatus), "%s | %d/%d", ext ? ++ext : "no ft", E.cy + 1, E.totalRows);
+    char rightStatus[64];
+    int rightLen;
+    if (E.showStats && E.frameBytes >= 0) {
+        rightLen = snprintf(rightStatus, sizeof(rightStatus), "write %ldB | %s | %d/%d",
+                            E.frameBytes, ext ? ++ext : "no ft", E.cy + 1, E.totalRows);
+    } else if (E.showStats) {
+        rightLen = snprintf(rightStatus, sizeof(rightStatus), "write n/a | %s | %d/%d",
+                            ext ? ++ext : "no ft", E.cy + 1, E.totalRows);
+    } else {
+        rightLen = snprintf(rightStatus, sizeof(rightStatus), "%s | %d/%d", ext ? ++ext : "no ft", E.cy + 1, E.totalRows);
+    }
+
+    char drawn[sizeof(E.drawnStatus)];
+    snprintf(drawn, sizeof(drawn), "%s|%s", leftStatus, rightStatus);
+    if (!E.damaged[E.screenRows] && strcmp(drawn, E.drawnStatus) == 0) {
+        attroff(A_REVERSE);
+        return;
+    }
+    strcpy(E.drawnStatus, drawn);
 
     mvhline(E.screenRows, 0, ' ', E.screenCols);
     mvprintw(E.screenRows, 0, "%s", leftStatus);
@@ -427,167 +900,371 @@ void editorStatusBar() {
 
 void editorMessageBar() {
     int y = E.screenRows + 1;
+    if (E.message[0] && time(NULL) - E.messageTime >= MESSAGE_TIMEOUT) {
+        E.message[0] = '\0';
+        E.damaged[y] = true;
+    }
+    if (!E.damaged[y]) return;
+
     mvhline(y, 0, ' ', E.screenCols);
+    if (search_mode) {
+        char prompt[sizeof(S.query) + sizeof(E.message) + 16];
+        snprintf(prompt, sizeof(prompt), "%s%s%s%s", S.regex ? "Regex: " : "Search: ", S.query,
+                 E.message[0] ? "    " : "", E.message);
+        mvaddnstr(y, 0, prompt, E.screenCols);
+        return;
+    }
+    if (E.message[0]) {
+        mvaddnstr(y, 0, E.message, E.screenCols);
+        return;
+    }
     char message[80];
-    snprintf(message, sizeof(message), "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+    snprintf(message, sizeof(message), "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-T = follow");
     mvaddstr(y, 0, message);
 }
 
-void editorFind(char *query) {
-    saved_cx = E.cx;
-    saved_cy = E.cy;
-    saved_rowoff = E.rowoff;
-    saved_currentRow = E.currentRow;
+/* Nearest match at or after `target` (direction > 0) or before it, from the match index when it can answer. */
+bool editorFindMatch(size_t target, int direction, size_t *match) {
+    if (S.job.running && matchIndexReady(&S.matches, &E.buf)) {
+        /* The search job owns the rest of the text; until it gets there only its prefix is known. */
+        size_t i = matchIndexLower(&S.matches, target);
+        if (direction > 0 ? i == S.matches.count : i == 0) return false;
+        *match = S.matches.hits[direction > 0 ? i : i - 1];
+        return true;
+    }
 
-    struct text *row = E.row;
-    S.row = NULL;
-    S.match_pos = -1;
+    bool more = matchIndexReady(&S.matches, &E.buf) && matchIndexExtend(&S.matches, &S.pattern, &E.buf, target);
+    if (!matchIndexReady(&S.matches, &E.buf)) {
+        return direction > 0
+            ? searchBufferForward(&S.pattern, &E.buf, target, match)
+            : searchBufferBackward(&S.pattern, &E.buf, target, match);
+    }
 
-    while (row) {
-        char *match = strstr(row->chars, query);
-        if (match) {
-            S.row = row;
-            S.match_pos = match - row->chars;
+    size_t i = matchIndexLower(&S.matches, target);
+    if (direction > 0 ? !more : i == 0) return false;
+    *match = S.matches.hits[direction > 0 ? i : i - 1];
+    return true;
+}
 
-            E.cx = S.match_pos;
-            E.cy = row->index;
-            E.currentRow = row;
-            return;
-        }
-        row = row->next;
-    }
+void editorGoToMatch(size_t offset) {
+    S.row = (int)bufferLineOf(&E.buf, offset);
+    S.match_pos = (int)(offset - bufferLineStart(&E.buf, S.row));
+    E.cx = S.match_pos;
+    E.cy = S.row;
+    editorScroll();
+}
 
-    snprintf(E.message, sizeof(E.message), "No match found for '%s'", query);
+/* Moves to the first match once the search has found one; until then the editor stays responsive. */
+void editorFirstMatch() {
+    size_t offset;
+    if (editorFindMatch(0, 1, &offset)) {
+        editorGoToMatch(offset);
+    } else if (!S.job.running) {
+        editorSetMessage("No match found for '%s'", S.pattern.chars);
+    }
 }
 
-void editorHighlightMatch(char *query) {
-    struct text *row = E.row;
-    for (int y = 0; row && y < E.totalRows; y++, row = row->next) {
-        char *match = strstr(row->chars, query);
-        while (match) {
-            int match_pos = match - row->chars;
+/*
+ * Starts searching for `query`, as a regular expression if `regex`; false if it is not a valid
+ * one. A plain query that only grew since the last call narrows the hits already found instead
+ * of searching the text again, and the job carries on past them with the longer query.
+ */
+bool editorFind(const char *query, bool regex) {
+    editorSync(true);
 
-            if (row == S.row && match_pos == S.match_pos) {
-                attron(COLOR_PAIR(2));
-                mvaddnstr(y - E.rowoff, match_pos, query, strlen(query));
-                attroff(COLOR_PAIR(2));
-            } else {
-                attron(COLOR_PAIR(1));
-                mvaddnstr(y - E.rowoff, match_pos, query, strlen(query));
-                attroff(COLOR_PAIR(1));
-            }
-            match = strstr(match + 1, query);
+    S.row = -1;
+    S.match_pos = -1;
+    if (query[0] == '\0') {
+        searchJobStop(&S.job);
+        searchFree(&S.pattern);
+        S.matches.valid = false;
+        return true;
+    }
+    if (S.pattern.chars == NULL || strcmp(S.pattern.chars, query) != 0 || (S.pattern.re != NULL) != regex) {
+        const char *error;
+        bool grown = !regex && S.pattern.chars != NULL && S.pattern.re == NULL &&
+                     strncmp(query, S.pattern.chars, S.pattern.len) == 0;
+        if (grown) searchJobPoll(&S.job, &S.matches);
+        searchJobStop(&S.job);
+        searchFree(&S.pattern);
+        if (!regex) {
+            searchCompile(&S.pattern, query, strlen(query));
+        } else if (searchCompileRegex(&S.pattern, query, strlen(query), &error) == -1) {
+            S.matches.valid = false;
+            editorSetMessage("Bad pattern: %s", error);
+            return false;
         }
+        if (!grown || !matchIndexRefine(&S.matches, &S.pattern, &E.buf)) S.matches.valid = false;
+    }
+    if (!matchIndexReady(&S.matches, &E.buf)) {
+        searchJobStop(&S.job);
+        matchIndexReset(&S.matches, &E.buf);
     }
+    if (!S.job.running) searchJobStart(&S.job, &S.pattern, &E.buf, &S.matches);
+    S.recount = false;
+    editorFirstMatch();
+    return true;
 }
-void editorSearchNext(char *query, int direction) {
-    struct text *row = direction > 0 ? S.row->next : S.row->prev;
-    int found = 0;
 
-    char *start_pos;
-    if (direction > 0) {
-        start_pos = S.row->chars + S.match_pos + 1;
+void editorSearchNext(int direction) {
+    if (S.row < 0) return;
+
+    size_t offset = editorRowOffset(S.row, S.match_pos);
+    size_t match;
+    if (editorFindMatch(direction > 0 ? offset + 1 : offset, direction, &match)) {
+        editorGoToMatch(match);
     } else {
-        start_pos = S.match_pos > 0 ? S.row->chars + S.match_pos - 1 : NULL;
+        editorSetMessage(S.job.running ? "Still searching..." : "No more matches found.");
     }
+}
 
-    if (start_pos && direction < 0) {
-        char *match = NULL;
-        for (char *p = start_pos; p >= S.row->chars; --p) {
-            if (strncmp(p, query, strlen(query)) == 0) {
-                match = p;
-                break;
-            }
-        }
+/*
+ * Replaces every match of `p` with `with`. All the matches are found before anything changes,
+ * so the buffer is rebuilt once however many there are.
+ */
+void editorReplaceAll(const struct searchPattern *p, const char *with) {
+    editorSync(true);
+    mvhline(E.screenRows + 1, 0, ' ', E.screenCols);
+    mvprintw(E.screenRows + 1, 0, "Replacing '%s'...", p->chars);
+    refresh();
+    editorDamage(E.screenRows + 1, E.screenRows + 2);
 
-        if (match) {
-            S.match_pos = match - S.row->chars;
-            found = 1;
-        }
-    } else if (start_pos) {
-        char *match = strstr(start_pos, query);
-        if (match) {
-            S.match_pos = match - S.row->chars;
-            found = 1;
+    size_t *starts, *ends;
+    size_t count = searchBufferAll(p, &E.buf, &starts, &ends);
+    if (count > 0 && with[0] == '\0') {
+        mvhline(E.screenRows + 1, 0, ' ', E.screenCols);
+        mvprintw(E.screenRows + 1, 0, "Delete %zu match%s of '%s'? (y/n)", count, count == 1 ? "" : "es", p->chars);
+        refresh();
+        if (getch() != 'y') {
+            free(starts);
+            free(ends);
+            editorSetMessage("Replace aborted");
+            return;
         }
     }
+    if (count > 0) {
+        E.isSave = true;
+        editorBufferReplace(starts, ends, count, with, strlen(with));
+    }
+    free(starts);
+    free(ends);
 
-    if (!found) {
-        while (row) {
-            char *match = direction > 0 ? strstr(row->chars, query) : NULL;
-            if (!match && direction < 0) {
-                for (char *p = row->chars + row->size - 1; p >= row->chars; --p) {
-                    if (strncmp(p, query, strlen(query)) == 0) {
-                        match = p;
-                        break;
-                    }
-                }
-            }
+    E.totalRows = (int)bufferLineCount(&E.buf);
+    if (E.cy >= E.totalRows) E.cy = E.totalRows - 1;
+    if (E.cx > editorRowSize(E.cy)) E.cx = editorRowSize(E.cy);
+    editorScroll();
+    editorDamage(0, E.screenRows);
 
-            if (match) {
-                S.row = row;
-                S.match_pos = match - row->chars;
-                found = 1;
-                break;
-            }
-            row = direction > 0 ? row->next : row->prev;
-        }
+    if (count == 0) {
+        editorSetMessage("No match found for '%s'", p->chars);
+    } else {
+        editorSetMessage("Replaced %zu match%s of '%s'", count, count == 1 ? "" : "es", p->chars);
+    }
+}
+
+/* Asks for a text and what to put in its place, then replaces every occurrence. */
+void editorReplace() {
+    if (!editorWritable()) return;
+
+    char query[256], with[256];
+    if (!editorPrompt("Replace: ", query, sizeof(query)) || query[0] == '\0') {
+        editorSetMessage("Replace aborted");
+        return;
+    }
+    /* An empty answer deletes every match; editorReplaceAll asks before doing that. */
+    if (!editorPrompt("With: ", with, sizeof(with))) {
+        editorSetMessage("Replace aborted");
+        return;
     }
 
-    if (found) {
-        E.cx = S.match_pos;
-        E.cy = S.row->index;
-        E.currentRow = S.row;
-        editorScroll();
-    } else {
-        snprintf(E.message, sizeof(E.message), "No more matches found.");
+    struct searchPattern pattern;
+    searchCompile(&pattern, query, strlen(query));
+    editorReplaceAll(&pattern, with);
+    searchFree(&pattern);
+}
+
+/* Marks the line holding the current match, in the coordinates of the frame on screen. */
+void editorDamageMatch() {
+    if (S.row < 0) return;
+    editorDamage(S.row - E.drawnRowoff, S.row - E.drawnRowoff + 1);
+}
+
+/* Takes in the hits the search job found since the last frame; called once per frame. */
+void editorSearchProgress() {
+    /* An edit stops the job; the search picks up again from what the index still holds, so the hit count catches up. */
+    if (!S.job.running && S.recount) {
+        S.recount = false;
+        if (!matchIndexReady(&S.matches, &E.buf)) matchIndexReset(&S.matches, &E.buf);
+        searchJobStart(&S.job, &S.pattern, &E.buf, &S.matches);
+    }
+    if (!S.job.running) return;
+
+    searchJobPoll(&S.job, &S.matches);
+    if (search_mode && S.row < 0) {
+        editorFirstMatch();
+        editorDamageMatch();
     }
 }
 
 
 void editorRefreshScreen() {
-    clear();
+    editorSync(false);
+    editorSaveProgress();
+    editorFollow();
+    editorWatch();
+    editorJournal();
+    editorSearchProgress();
+
+    bool empty = bufferLength(&E.buf) == 0;
+    int shift = E.rowoff - E.drawnRowoff;
+    if (empty != E.drawnEmpty || E.coloff != E.drawnColoff || shift >= E.screenRows || shift <= -E.screenRows) {
+        editorDamage(0, E.screenRows);
+    } else if (shift != 0) {
+        editorScrollRegion(shift);
+    }
+    if (E.totalRows != E.drawnTotalRows) {
+        int first = E.totalRows < E.drawnTotalRows ? E.totalRows : E.drawnTotalRows;
+        editorDamage(first - E.rowoff, E.screenRows);
+    }
+    E.drawnRowoff = E.rowoff;
+    E.drawnColoff = E.coloff;
+    E.drawnTotalRows = E.totalRows;
+    E.drawnEmpty = empty;
+
+    /* Reading the counter is a file open and parse, so it is skipped unless the stats are shown. */
+    long before = E.showStats ? editorBytesWritten() : -1;
     editorRows();
     editorStatusBar();
     editorMessageBar();
-    move(E.cy - E.rowoff, E.cx < E.screenCols ? E.cx : E.screenCols - 1);
-    refresh();
+    if (search_mode) {
+        int x = (S.regex ? 7 : 8) + S.queryLen;
+        move(E.screenRows + 1, x < E.screenCols ? x : E.screenCols - 1);
+    } else {
+        move(E.cy - E.rowoff, E.cx - E.coloff);
+    }
+    wnoutrefresh(stdscr);
+    doupdate();
+    memset(E.damaged, 0, (E.screenRows + 2) * sizeof(bool));
+
+    if (E.showStats) {
+        long after = editorBytesWritten();
+        E.frameBytes = before >= 0 && after >= 0 ? after - before : -1;
+    }
+}
+
+int editorReadKey() {
+    /* Wake up to advance indexing and saving, poll the file on disk, flush the journal and take down an expired message. */
+    int wait = -1;
+    if (E.message[0]) {
+        wait = (int)(E.messageTime + MESSAGE_TIMEOUT - time(NULL)) * 1000;
+        if (wait < 0) wait = 0;
+    }
+    if ((bufferIndexing(&E.buf) || E.saving || E.follow.active || S.job.running) && (wait < 0 || wait > 100)) wait = 100;
+    if (E.watch.active && (wait < 0 || wait > WATCH_INTERVAL)) wait = WATCH_INTERVAL;
+    if (journalPending(&E.journal) && (wait < 0 || wait > JOURNAL_INTERVAL)) wait = JOURNAL_INTERVAL;
+    timeout(wait);
+    int c = getch();
+    timeout(-1);
+    return c;
 }
 
 void updateWindowSize() {
     getmaxyx(stdscr, E.screenRows, E.screenCols);
     E.screenRows -= 2;
+    editorResizeDamage();
+    clearok(stdscr, TRUE);
     editorRefreshScreen();
 }
 
-void editorSearchMode(char *query) {
+/* Searches again for the query as typed so far; called after every keystroke that changes it. */
+void editorSearchQuery() {
+    S.query[S.queryLen] = '\0';
+    E.message[0] = '\0';
+    editorDamage(0, E.screenRows + 2);
+    if (!editorFind(S.query, S.regex)) return;
+    if (S.row < 0) {
+        E.cx = saved_cx;
+        E.cy = saved_cy;
+        E.rowoff = saved_rowoff;
+        E.coloff = saved_coloff;
+    }
+}
+
+/*
+ * The search prompt: the query is searched for as it is typed, and the arrow keys move between
+ * the matches found so far. The job that searches the whole file keeps running between keys.
+ */
+void editorSearchMode(bool regex) {
+    saved_cx = E.cx;
+    saved_cy = E.cy;
+    saved_rowoff = E.rowoff;
+    saved_coloff = E.coloff;
+    /* Jumping to a match moves the cursor like any other move. */
+    undoBreak(&E.undo);
+
+    search_mode = true;
+    S.regex = regex;
+    S.queryLen = 0;
+    editorSearchQuery();
+
     while (search_mode) {
         editorRefreshScreen();
-        editorHighlightMatch(query);
 
-        int c = getch();
+        int c = editorReadKey();
         switch (c) {
+            case ERR:
+                break;
+            case '\b':
+            case 127:
+            case KEY_BACKSPACE:
+                if (S.queryLen > 0) {
+                    S.queryLen--;
+                    editorSearchQuery();
+                }
+                break;
             case KEY_RIGHT:
-                editorSearchNext(query, 1);
+                editorDamageMatch();
+                editorSearchNext(1);
+                editorDamageMatch();
                 break;
             case KEY_LEFT:
-                editorSearchNext(query, -1);
+                editorDamageMatch();
+                editorSearchNext(-1);
+                editorDamageMatch();
                 break;
             case '\n':
             case '\r':
                 search_mode = false;
                 return;
+            case CTRL_KEY('e'):
+                if (S.pattern.len > 0 && editorWritable()) {
+                    char with[256];
+                    if (editorPrompt("Replace all with: ", with, sizeof(with)) != NULL) {
+                        editorReplaceAll(&S.pattern, with);
+                    } else {
+                        editorSetMessage("Replace aborted");
+                    }
+                }
+                search_mode = false;
+                return;
             case 27:
+                searchJobStop(&S.job);
                 E.cx = saved_cx;
                 E.cy = saved_cy;
                 E.rowoff = saved_rowoff;
-                E.currentRow = saved_currentRow;
+                E.coloff = saved_coloff;
                 search_mode = false;
                 return;
             case KEY_RESIZE:
                 updateWindowSize();
                 editorScroll();
                 break;
+            default:
+                if (((c >= 32 && c <= 126) || (c >= 192 && c <= 255)) && S.queryLen < (int)sizeof(S.query) - 1) {
+                    S.query[S.queryLen++] = (char)c;
+                    editorSearchQuery();
+                }
+                break;
         }
     }
 }
@@ -600,37 +1277,58 @@ int main(int argc, char *argv[]) {
     initEditor();
     initColors();
 
-    if (argc >= 2) {
-        editorOpen(argv[1]);
+    int arg = 1;
+    bool readOnly = arg < argc && strcmp(argv[arg], "-r") == 0;
+    if (readOnly) arg++;
+    if (arg < argc) {
+        E.readOnly = readOnly;
+        editorOpen(argv[arg]);
     }
 
     while (1) {
         editorRefreshScreen();
-        int c = getch();
+        int c = editorReadKey();
         switch (c) {
+            case ERR:
+                break;
             case CTRL_KEY('q'):
+                while (E.saving) {
+                    mvhline(E.screenRows + 1, 0, ' ', E.screenCols);
+                    mvprintw(E.screenRows + 1, 0, "Waiting for %s to be saved...", E.saver.filename);
+                    refresh();
+                    saveWait(&E.saver);
+                    editorSaveProgress();
+                }
                 if (E.isSave) {
                     mvhline(E.screenRows, 0, ' ', E.screenCols);
                     mvprintw(E.screenRows, 0, "Unsaved changes! Press Ctrl-Q again to quit.");
                     refresh();
+                    editorDamage(E.screenRows, E.screenRows + 1);
                     int confirm = getch();
                     if (confirm != CTRL_KEY('q')) break;
+                    journalDiscard(&E.journal);
                 }
                 endwin();
                 exit(0);
             case CTRL_KEY('s'):
                 editorSave();
                 break;
+            case CTRL_KEY('t'):
+                editorToggleFollow();
+                break;
+            case CTRL_KEY('e'):
+                editorReplace();
+                break;
+            case CTRL_KEY('z'):
+                editorUndo(false);
+                break;
+            case CTRL_KEY('y'):
+                editorUndo(true);
+                break;
             case CTRL_KEY('f'):
-                search_mode = true;
-                char query[256];
-                mvhline(E.screenRows + 1, 0, ' ', E.screenCols);
-                mvprintw(E.screenRows + 1, 0, "Search: ");
-                echo();
-                getnstr(query, sizeof(query) - 1);
-                noecho();
-                editorFind(query);
-                editorSearchMode(query);
+            case CTRL_KEY('r'):
+                editorSearchMode(c == CTRL_KEY('r'));
+                editorDamage(0, E.screenRows + 2);
                 break;
             case KEY_UP:
             case KEY_DOWN:
@@ -0,0 +1,918 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "regex.h"
+
+/* Deepest nesting of groups the parser recurses through. */
+#define REGEX_DEPTH_MAX 100
+
+/* Largest count accepted in a {m,n} repetition. */
+#define REGEX_REPEAT_MAX 1000
+
+/* Longest literal prefix handed to the prefilter. */
+#define REGEX_PREFIX_MAX 64
+
+/* A backward search looks at this much text before the previous match first, then twice as much each time. */
+#define REGEX_BACK_SPAN ((size_t)64 << 10)
+
+enum regexNodeKind {
+    NODE_EMPTY,
+    NODE_SET,
+    NODE_BOL,
+    NODE_EOL,
+    NODE_CAT,
+    NODE_ALT,
+    NODE_REPEAT
+};
+
+/* The parsed pattern; a REPEAT with max -1 has no upper bound. */
+struct regexNode {
+    int kind;
+    int left, right;
+    int set;
+    int min, max;
+    bool greedy;
+};
+
+struct regexParser {
+    const char *s;
+    size_t len, pos;
+    int depth;
+    struct regexNode *nodes;
+    int count, cap;
+    struct regex *re;
+    const char *error;
+};
+
+enum regexMode {
+    DFA_LEFTMOST,
+    DFA_ANCHORED,
+    DFA_LONGEST
+};
+
+/* State flags: the last byte read was a newline, and (leftmost mode) a match has already been seen. */
+#define DFA_BOL 1u
+#define DFA_DONE 2u
+
+/*
+ * A transition is the next state times 256, which is where its row of transitions starts, plus
+ * DFA_MATCH if a match ends before the byte, and DFA_ALERT if the scan must look at the next
+ * state: it is dead, or a start state the prefilter can skip ahead from or that begins a line.
+ * Transitions not worked out yet are DFA_UNKNOWN, which has both bits set.
+ */
+#define DFA_MATCH 1
+#define DFA_ALERT 2
+#define DFA_SHIFT 8
+#define DFA_UNKNOWN (-1)
+
+/* Text to run a DFA over: either a piece table or bytes in memory that may sit inside a longer line. */
+struct regexText {
+    const struct textBuffer *b;
+    const char *s;
+    size_t length;
+    bool lineStart, lineEnd;
+};
+
+static int setNew(struct regex *re) {
+    if (re->setCount == re->setCap) {
+        re->setCap = re->setCap ? re->setCap * 2 : 16;
+        re->sets = (unsigned char (*)[32])realloc(re->sets, re->setCap * sizeof(*re->sets));
+    }
+    memset(re->sets[re->setCount], 0, 32);
+    return re->setCount++;
+}
+
+static void setAdd(unsigned char *set, int lo, int hi) {
+    for (int c = lo; c <= hi; c++) set[c >> 3] |= (unsigned char)(1u << (c & 7));
+}
+
+static bool setHas(const unsigned char *set, int c) {
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+/* \d, \w and \s and their complements; false for any other letter. */
+static bool setAddEscape(unsigned char *set, char c) {
+    unsigned char class[32] = {0};
+    switch (c | 0x20) {
+        case 'd':
+            setAdd(class, '0', '9');
+            break;
+        case 'w':
+            setAdd(class, '0', '9');
+            setAdd(class, 'a', 'z');
+            setAdd(class, 'A', 'Z');
+            setAdd(class, '_', '_');
+            break;
+        case 's':
+            setAdd(class, ' ', ' ');
+            setAdd(class, '\t', '\t');
+            setAdd(class, '\r', '\r');
+            setAdd(class, '\f', '\f');
+            setAdd(class, '\v', '\v');
+            break;
+        default:
+            return false;
+    }
+    bool negate = c >= 'A' && c <= 'Z';
+    for (int i = 0; i < 32; i++) set[i] |= negate ? (unsigned char)~class[i] : class[i];
+    return true;
+}
+
+static int nodeNew(struct regexParser *ps, int kind, int left, int right) {
+    if (ps->count == ps->cap) {
+        ps->cap = ps->cap ? ps->cap * 2 : 32;
+        ps->nodes = (struct regexNode *)realloc(ps->nodes, ps->cap * sizeof(struct regexNode));
+    }
+    struct regexNode *node = &ps->nodes[ps->count];
+    memset(node, 0, sizeof(*node));
+    node->kind = kind;
+    node->left = left;
+    node->right = right;
+    node->set = -1;
+    return ps->count++;
+}
+
+/* Matches never span lines, so no set ever holds the newline. */
+static int nodeSet(struct regexParser *ps, const unsigned char *set) {
+    int id = setNew(ps->re);
+    memcpy(ps->re->sets[id], set, 32);
+    ps->re->sets[id]['\n' >> 3] &= (unsigned char)~(1u << ('\n' & 7));
+    int node = nodeNew(ps, NODE_SET, -1, -1);
+    ps->nodes[node].set = id;
+    return node;
+}
+
+static int nodeChar(struct regexParser *ps, unsigned char c) {
+    unsigned char set[32] = {0};
+    setAdd(set, c, c);
+    return nodeSet(ps, set);
+}
+
+static int fail(struct regexParser *ps, const char *error) {
+    if (ps->error == NULL) ps->error = error;
+    return -1;
+}
+
+static char escapeChar(char c) {
+    switch (c) {
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        default: return c;
+    }
+}
+
+/* The escape after a backslash, which the caller has consumed, as a one-byte literal or -1 with the error set. */
+static int parseEscapeChar(struct regexParser *ps) {
+    if (ps->pos == ps->len) return fail(ps, "trailing backslash");
+    char c = ps->s[ps->pos++];
+    if (c >= '1' && c <= '9') return fail(ps, "backreferences are not supported");
+    if (c == 'b' || c == 'B') return fail(ps, "word boundaries are not supported");
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+        if (strchr("tnrfv", c) == NULL) return fail(ps, "unknown escape");
+        return (unsigned char)escapeChar(c);
+    }
+    return (unsigned char)c;
+}
+
+static int parseClass(struct regexParser *ps) {
+    unsigned char set[32] = {0};
+    bool negate = ps->pos < ps->len && ps->s[ps->pos] == '^';
+    if (negate) ps->pos++;
+
+    bool first = true;
+    while (ps->pos < ps->len && (ps->s[ps->pos] != ']' || first)) {
+        first = false;
+        int lo = (unsigned char)ps->s[ps->pos++];
+        if (lo == '\\') {
+            if (ps->pos < ps->len && setAddEscape(set, ps->s[ps->pos])) {
+                ps->pos++;
+                continue;
+            }
+            lo = parseEscapeChar(ps);
+            if (lo < 0) return -1;
+        }
+
+        int hi = lo;
+        if (ps->pos + 1 < ps->len && ps->s[ps->pos] == '-' && ps->s[ps->pos + 1] != ']') {
+            ps->pos++;
+            hi = (unsigned char)ps->s[ps->pos++];
+            if (hi == '\\') {
+                hi = parseEscapeChar(ps);
+                if (hi < 0) return -1;
+            }
+            if (hi < lo) return fail(ps, "bad range in []");
+        }
+        setAdd(set, lo, hi);
+    }
+    if (ps->pos == ps->len) return fail(ps, "missing ]");
+    ps->pos++;
+
+    if (negate) {
+        for (int i = 0; i < 32; i++) set[i] = (unsigned char)~set[i];
+    }
+    return nodeSet(ps, set);
+}
+
+static int parseAlt(struct regexParser *ps);
+
+static int parseAtom(struct regexParser *ps) {
+    char c = ps->s[ps->pos++];
+    switch (c) {
+        case '(': {
+            if (++ps->depth > REGEX_DEPTH_MAX) return fail(ps, "groups nested too deeply");
+            if (ps->pos + 1 < ps->len && ps->s[ps->pos] == '?' && ps->s[ps->pos + 1] == ':') ps->pos += 2;
+            int node = parseAlt(ps);
+            if (node < 0) return -1;
+            if (ps->pos == ps->len || ps->s[ps->pos] != ')') return fail(ps, "missing )");
+            ps->pos++;
+            ps->depth--;
+            return node;
+        }
+        case '[':
+            return parseClass(ps);
+        case '.': {
+            unsigned char set[32];
+            memset(set, 0xff, sizeof(set));
+            return nodeSet(ps, set);
+        }
+        case '^':
+            return nodeNew(ps, NODE_BOL, -1, -1);
+        case '$':
+            return nodeNew(ps, NODE_EOL, -1, -1);
+        case '*':
+        case '+':
+        case '?':
+            return fail(ps, "nothing to repeat");
+        case '\\': {
+            unsigned char set[32] = {0};
+            if (ps->pos < ps->len && setAddEscape(set, ps->s[ps->pos])) {
+                ps->pos++;
+                return nodeSet(ps, set);
+            }
+            int literal = parseEscapeChar(ps);
+            return literal < 0 ? -1 : nodeChar(ps, (unsigned char)literal);
+        }
+        default:
+            return nodeChar(ps, (unsigned char)c);
+    }
+}
+
+/* Reads a count of at most REGEX_REPEAT_MAX; -1 if there is no number here. */
+static int parseCount(struct regexParser *ps) {
+    if (ps->pos == ps->len || ps->s[ps->pos] < '0' || ps->s[ps->pos] > '9') return -1;
+    int n = 0;
+    while (ps->pos < ps->len && ps->s[ps->pos] >= '0' && ps->s[ps->pos] <= '9') {
+        n = n * 10 + (ps->s[ps->pos++] - '0');
+        if (n > REGEX_REPEAT_MAX) n = REGEX_REPEAT_MAX + 1;
+    }
+    return n;
+}
+
+/* {m}, {m,} or {m,n}; anything else leaves `pos` alone so the brace is read as a literal. */
+static bool parseBraces(struct regexParser *ps, int *min, int *max) {
+    size_t at = ps->pos;
+    ps->pos++;
+    *min = parseCount(ps);
+    *max = *min;
+    if (*min >= 0 && ps->pos < ps->len && ps->s[ps->pos] == ',') {
+        ps->pos++;
+        *max = parseCount(ps);
+    }
+    if (*min < 0 || ps->pos == ps->len || ps->s[ps->pos] != '}') {
+        ps->pos = at;
+        return false;
+    }
+    ps->pos++;
+    return true;
+}
+
+static int parseRepeat(struct regexParser *ps) {
+    int node = parseAtom(ps);
+    while (node >= 0 && ps->pos < ps->len) {
+        int min, max;
+        char c = ps->s[ps->pos];
+        if (c == '*' || c == '+' || c == '?') {
+            ps->pos++;
+            min = c == '+' ? 1 : 0;
+            max = c == '?' ? 1 : -1;
+        } else if (c != '{' || !parseBraces(ps, &min, &max)) {
+            break;
+        } else if (min > REGEX_REPEAT_MAX || max > REGEX_REPEAT_MAX) {
+            return fail(ps, "repetition count too large");
+        } else if (max >= 0 && max < min) {
+            return fail(ps, "bad repetition count");
+        }
+
+        node = nodeNew(ps, NODE_REPEAT, node, -1);
+        ps->nodes[node].min = min;
+        ps->nodes[node].max = max;
+        ps->nodes[node].greedy = true;
+        if (ps->pos < ps->len && ps->s[ps->pos] == '?') {
+            ps->pos++;
+            ps->nodes[node].greedy = false;
+        }
+    }
+    return node;
+}
+
+static int parseCat(struct regexParser *ps) {
+    int node = -1;
+    while (ps->pos < ps->len && ps->s[ps->pos] != '|' && ps->s[ps->pos] != ')') {
+        int next = parseRepeat(ps);
+        if (next < 0) return -1;
+        node = node < 0 ? next : nodeNew(ps, NODE_CAT, node, next);
+    }
+    return node < 0 ? nodeNew(ps, NODE_EMPTY, -1, -1) : node;
+}
+
+static int parseAlt(struct regexParser *ps) {
+    int node = parseCat(ps);
+    while (node >= 0 && ps->pos < ps->len && ps->s[ps->pos] == '|') {
+        ps->pos++;
+        int next = parseCat(ps);
+        if (next < 0) return -1;
+        node = nodeNew(ps, NODE_ALT, node, next);
+    }
+    return node;
+}
+
+static bool nodeNullable(const struct regexParser *ps, int id) {
+    const struct regexNode *node = &ps->nodes[id];
+    switch (node->kind) {
+        case NODE_SET:
+            return false;
+        case NODE_CAT:
+            return nodeNullable(ps, node->left) && nodeNullable(ps, node->right);
+        case NODE_ALT:
+            return nodeNullable(ps, node->left) || nodeNullable(ps, node->right);
+        case NODE_REPEAT:
+            return node->min == 0 || nodeNullable(ps, node->left);
+        default:
+            return true;
+    }
+}
+
+/* Appends the literal every match of `id` starts with; true if the whole node was literal and the next one may add to it. */
+static bool nodePrefix(const struct regexParser *ps, int id, char *prefix, size_t *len) {
+    const struct regexNode *node = &ps->nodes[id];
+    switch (node->kind) {
+        case NODE_EMPTY:
+        case NODE_BOL:
+            return true;
+        case NODE_SET: {
+            const unsigned char *set = ps->re->sets[node->set];
+            int only = -1;
+            for (int c = 0; c < 256; c++) {
+                if (!setHas(set, c)) continue;
+                if (only >= 0) return false;
+                only = c;
+            }
+            if (only < 0 || *len == REGEX_PREFIX_MAX) return false;
+            prefix[(*len)++] = (char)only;
+            return true;
+        }
+        case NODE_CAT:
+            return nodePrefix(ps, node->left, prefix, len) && nodePrefix(ps, node->right, prefix, len);
+        case NODE_REPEAT:
+            if (node->min > 0) nodePrefix(ps, node->left, prefix, len);
+            return false;
+        default:
+            return false;
+    }
+}
+
+static int emit(struct regexProgram *p, int op, int next, int alt, int set) {
+    if (p->count == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 64;
+        p->insts = (struct regexInst *)realloc(p->insts, p->cap * sizeof(struct regexInst));
+    }
+    struct regexInst *inst = &p->insts[p->count];
+    inst->op = op;
+    inst->next = next;
+    inst->alt = alt;
+    inst->set = set;
+    return p->count++;
+}
+
+/*
+ * Emits code for node `id` that continues at `next` and returns its entry point. The reverse
+ * program reads concatenations back to front and swaps the line anchors, since reading backward
+ * the start of a line is where the text runs out and the end of one is behind us.
+ */
+static int compileNode(const struct regexParser *ps, struct regexProgram *p, int id, int next, bool reverse) {
+    const struct regexNode *node = &ps->nodes[id];
+    if (p->count > REGEX_PROGRAM_MAX) return next;
+
+    switch (node->kind) {
+        case NODE_SET:
+            return emit(p, REGEX_CLASS, next, -1, node->set);
+        case NODE_BOL:
+            return emit(p, reverse ? REGEX_EOL : REGEX_BOL, next, -1, -1);
+        case NODE_EOL:
+            return emit(p, reverse ? REGEX_BOL : REGEX_EOL, next, -1, -1);
+        case NODE_CAT:
+            if (reverse) return compileNode(ps, p, node->right, compileNode(ps, p, node->left, next, reverse), reverse);
+            return compileNode(ps, p, node->left, compileNode(ps, p, node->right, next, reverse), reverse);
+        case NODE_ALT: {
+            int left = compileNode(ps, p, node->left, next, reverse);
+            int right = compileNode(ps, p, node->right, next, reverse);
+            return emit(p, REGEX_SPLIT, left, right, -1);
+        }
+        case NODE_REPEAT: {
+            int entry;
+            if (node->max < 0) {
+                int loop = emit(p, REGEX_SPLIT, -1, -1, -1);
+                int body = compileNode(ps, p, node->left, loop, reverse);
+                p->insts[loop].next = node->greedy ? body : next;
+                p->insts[loop].alt = node->greedy ? next : body;
+                entry = loop;
+            } else {
+                /* x{0,3} is (x(x(x)?)?)?: each optional copy skips straight to what follows. */
+                entry = next;
+                for (int i = node->min; i < node->max; i++) {
+                    int body = compileNode(ps, p, node->left, entry, reverse);
+                    entry = node->greedy ? emit(p, REGEX_SPLIT, body, next, -1) : emit(p, REGEX_SPLIT, next, body, -1);
+                }
+            }
+            for (int i = 0; i < node->min; i++) {
+                entry = compileNode(ps, p, node->left, entry, reverse);
+            }
+            return entry;
+        }
+        default:
+            return next;
+    }
+}
+
+static bool compileProgram(const struct regexParser *ps, struct regexProgram *p, int root, bool reverse) {
+    int match = emit(p, REGEX_MATCH, -1, -1, -1);
+    p->start = compileNode(ps, p, root, match, reverse);
+    return p->count <= REGEX_PROGRAM_MAX;
+}
+
+/*
+ * Compiles `pattern`: literals, ., [...] classes, \d \w \s and their complements, ^ and $ at line
+ * ends, groups, |, and the repetitions * + ? {m,n}, each of which may be made lazy with a
+ * trailing ?. Matches never span lines and may not be empty. Returns -1 with `error` set if the
+ * pattern is not one of these.
+ */
+int regexCompile(struct regex *re, const char *pattern, size_t len, const char **error) {
+    memset(re, 0, sizeof(*re));
+    struct regexParser ps = {0};
+    ps.s = pattern;
+    ps.len = len;
+    ps.re = re;
+
+    int root = parseAlt(&ps);
+    if (root >= 0 && ps.pos < ps.len) root = fail(&ps, "unmatched )");
+    if (root >= 0 && nodeNullable(&ps, root)) root = fail(&ps, "pattern matches empty text");
+    if (root >= 0 && (!compileProgram(&ps, &re->forward, root, false) ||
+                      !compileProgram(&ps, &re->reverse, root, true))) {
+        root = fail(&ps, "pattern too large");
+    }
+
+    if (root >= 0) {
+        char prefix[REGEX_PREFIX_MAX];
+        size_t prefixLen = 0;
+        nodePrefix(&ps, root, prefix, &prefixLen);
+        if (prefixLen > 0) searchCompile(&re->prefix, prefix, prefixLen);
+    }
+    free(ps.nodes);
+
+    if (root < 0) {
+        *error = ps.error;
+        regexFree(re);
+        return -1;
+    }
+    return 0;
+}
+
+void regexFree(struct regex *re) {
+    free(re->forward.insts);
+    free(re->reverse.insts);
+    free(re->sets);
+    if (re->prefix.chars) searchFree(&re->prefix);
+    memset(re, 0, sizeof(*re));
+}
+
+static void dfaReset(struct regexDfa *d) {
+    d->stateCount = 0;
+    d->poolLen = 0;
+    d->starts[0] = d->starts[1] = -1;
+    for (int i = 0; i < d->tableCap; i++) d->table[i] = -1;
+}
+
+static void dfaInit(struct regexDfa *d, const struct regex *re, const struct regexProgram *program, int mode) {
+    memset(d, 0, sizeof(*d));
+    d->re = re;
+    d->program = program;
+    d->mode = mode;
+    d->poolCap = 1024;
+    d->pool = (int *)malloc(d->poolCap * sizeof(int));
+    d->tableCap = 2 * REGEX_STATES_MAX;
+    d->table = (int *)malloc(d->tableCap * sizeof(int));
+    d->list = (int *)malloc(2 * program->count * sizeof(int));
+    d->stack = (int *)malloc((2 * program->count + 2) * sizeof(int));
+    d->mark = (unsigned *)calloc(program->count, sizeof(unsigned));
+    dfaReset(d);
+}
+
+static void dfaFree(struct regexDfa *d) {
+    free(d->states);
+    free(d->next);
+    free(d->pool);
+    free(d->table);
+    free(d->list);
+    free(d->stack);
+    free(d->mark);
+    memset(d, 0, sizeof(*d));
+}
+
+void regexMatcherInit(struct regexMatcher *m, const struct regex *re) {
+    dfaInit(&m->leftmost, re, &re->forward, DFA_LEFTMOST);
+    dfaInit(&m->anchored, re, &re->forward, DFA_ANCHORED);
+    dfaInit(&m->reverse, re, &re->reverse, DFA_LONGEST);
+}
+
+void regexMatcherFree(struct regexMatcher *m) {
+    dfaFree(&m->leftmost);
+    dfaFree(&m->anchored);
+    dfaFree(&m->reverse);
+}
+
+/*
+ * Adds the instructions reachable from `pc` without reading a byte to `list`, in priority order.
+ * An $ whose next byte is not known yet stays in the list to be settled by the byte that follows.
+ */
+static void dfaAdd(struct regexDfa *d, int *list, int *count, int pc, bool bol, bool eol) {
+    const struct regexInst *insts = d->program->insts;
+    int top = 0;
+    d->stack[top++] = pc;
+
+    while (top > 0) {
+        pc = d->stack[--top];
+        if (d->mark[pc] == d->generation) continue;
+        d->mark[pc] = d->generation;
+
+        const struct regexInst *inst = &insts[pc];
+        switch (inst->op) {
+            case REGEX_SPLIT:
+                d->stack[top++] = inst->alt;
+                d->stack[top++] = inst->next;
+                break;
+            case REGEX_BOL:
+                if (bol) d->stack[top++] = inst->next;
+                break;
+            case REGEX_EOL:
+                if (eol) {
+                    d->stack[top++] = inst->next;
+                } else {
+                    list[(*count)++] = pc;
+                }
+                break;
+            default:
+                list[(*count)++] = pc;
+                break;
+        }
+    }
+}
+
+static unsigned dfaHash(const int *list, int count, unsigned flags) {
+    unsigned hash = 2166136261u ^ flags;
+    for (int i = 0; i < count; i++) {
+        hash = (hash ^ (unsigned)list[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* The state for `list`, made if it is new. A full cache is emptied first, so other state numbers go stale. */
+static int dfaIntern(struct regexDfa *d, const int *list, int count, unsigned flags) {
+    unsigned mask = (unsigned)d->tableCap - 1;
+    unsigned slot = dfaHash(list, count, flags) & mask;
+    for (; d->table[slot] >= 0; slot = (slot + 1) & mask) {
+        const struct regexState *st = &d->states[d->table[slot]];
+        if (st->flags == flags && st->count == count && memcmp(d->pool + st->first, list, count * sizeof(int)) == 0) {
+            return d->table[slot];
+        }
+    }
+
+    if (d->stateCount == REGEX_STATES_MAX) {
+        dfaReset(d);
+        for (slot = dfaHash(list, count, flags) & mask; d->table[slot] >= 0; slot = (slot + 1) & mask) {}
+    }
+    if (d->stateCount == d->stateCap) {
+        d->stateCap = d->stateCap ? d->stateCap * 2 : 16;
+        d->states = (struct regexState *)realloc(d->states, d->stateCap * sizeof(struct regexState));
+        d->next = (int *)realloc(d->next, ((size_t)d->stateCap << DFA_SHIFT) * sizeof(int));
+    }
+    if (d->poolLen + count > d->poolCap) {
+        d->poolCap *= 2;
+        while (d->poolLen + count > d->poolCap) d->poolCap *= 2;
+        d->pool = (int *)realloc(d->pool, d->poolCap * sizeof(int));
+    }
+
+    int id = d->stateCount++;
+    struct regexState *st = &d->states[id];
+    st->first = (int)d->poolLen;
+    st->count = count;
+    st->flags = flags;
+    st->atEnd = -1;
+    st->start = false;
+    st->dead = count == 0 && (d->mode != DFA_LEFTMOST || (flags & DFA_DONE));
+    memset(d->next + ((size_t)id << DFA_SHIFT), 0xff, 256 * sizeof(int));
+    memcpy(d->pool + d->poolLen, list, count * sizeof(int));
+    d->poolLen += count;
+    d->table[slot] = id;
+    return id;
+}
+
+static int dfaStart(struct regexDfa *d, bool bol) {
+    if (d->starts[bol] >= 0) return d->starts[bol];
+
+    int count = 0;
+    d->generation++;
+    dfaAdd(d, d->list, &count, d->program->start, bol, false);
+    int id = dfaIntern(d, d->list, count, bol ? DFA_BOL : 0);
+    d->states[id].start = d->mode == DFA_LEFTMOST;
+    d->starts[bol] = id;
+    return id;
+}
+
+/*
+ * Settles the $ instructions of state `s` against the next byte being a line end or not, into
+ * d->list; sets `matched` if the match instruction is reached before anything is read.
+ */
+static int dfaSettle(struct regexDfa *d, int s, bool eol, bool *matched) {
+    const struct regexState *st = &d->states[s];
+    const struct regexInst *insts = d->program->insts;
+    int count = 0;
+
+    *matched = false;
+    d->generation++;
+    for (int i = 0; i < st->count; i++) {
+        int pc = d->pool[st->first + i];
+        if (insts[pc].op == REGEX_EOL) {
+            if (eol) dfaAdd(d, d->list, &count, insts[pc].next, st->flags & DFA_BOL, true);
+        } else if (d->mark[pc] != d->generation) {
+            d->mark[pc] = d->generation;
+            d->list[count++] = pc;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        if (insts[d->list[i]].op != REGEX_MATCH) continue;
+        *matched = true;
+        /* Leftmost-first: whatever the match outranks can never be the answer. */
+        if (d->mode != DFA_LONGEST) count = i;
+        break;
+    }
+    return count;
+}
+
+/* Works out and caches the transition of state `s` on byte `c`. */
+static int dfaStep(struct regexDfa *d, int s, unsigned char c) {
+    const struct regexInst *insts = d->program->insts;
+    unsigned flags = d->states[s].flags;
+    bool matched;
+    int count = dfaSettle(d, s, c == '\n', &matched);
+
+    int *out = d->list + d->program->count;
+    int outCount = 0;
+    d->generation++;
+    for (int i = 0; i < count; i++) {
+        const struct regexInst *inst = &insts[d->list[i]];
+        if (inst->op == REGEX_CLASS && setHas(d->re->sets[inst->set], c)) {
+            dfaAdd(d, out, &outCount, inst->next, c == '\n', false);
+        }
+    }
+
+    /* Unanchored search starts a new attempt at every byte until some attempt has matched. */
+    bool done = (flags & DFA_DONE) || matched;
+    if (d->mode == DFA_LEFTMOST && !done) dfaAdd(d, out, &outCount, d->program->start, c == '\n', false);
+
+    unsigned nextFlags = (c == '\n' ? DFA_BOL : 0) | (d->mode == DFA_LEFTMOST && done ? DFA_DONE : 0);
+    int stateCount = d->stateCount;
+    int next = dfaIntern(d, out, outCount, nextFlags);
+    bool flushed = d->stateCount < stateCount;
+    if (flushed) {
+        /* The cache was emptied and `s` went with it; bring back the start states so they are recognised. */
+        dfaStart(d, false);
+        dfaStart(d, true);
+    }
+
+    int transition = next << DFA_SHIFT | (matched ? DFA_MATCH : 0);
+    /* A start state only matters where the prefilter can skip, or at a line start, where a scan may end. */
+    const struct regexState *to = &d->states[next];
+    if (to->dead || (to->start && (d->re->prefix.len > 0 || c == '\n'))) transition |= DFA_ALERT;
+    if (!flushed) d->next[s << DFA_SHIFT | c] = transition;
+    return transition;
+}
+
+static int dfaNext(struct regexDfa *d, int s, unsigned char c) {
+    int transition = d->next[s << DFA_SHIFT | c];
+    return transition == DFA_UNKNOWN ? dfaStep(d, s, c) : transition;
+}
+
+/* Whether a match ends where the text runs out, the end being a line end if `eol`. */
+static bool dfaFinal(struct regexDfa *d, int s, bool eol) {
+    if (eol && d->states[s].atEnd >= 0) return d->states[s].atEnd;
+
+    bool matched;
+    dfaSettle(d, s, eol, &matched);
+    if (eol) d->states[s].atEnd = matched;
+    return matched;
+}
+
+static size_t textChunk(const struct regexText *t, size_t offset, const char **chars) {
+    if (t->b) return bufferChunk(t->b, offset, chars);
+    *chars = t->s + offset;
+    return t->length - offset;
+}
+
+static size_t textChunkBefore(const struct regexText *t, size_t offset, const char **chars) {
+    if (t->b) return bufferChunkBefore(t->b, offset, chars);
+    *chars = t->s;
+    return offset;
+}
+
+static int textByte(const struct regexText *t, size_t offset) {
+    return t->b ? bufferCharAt(t->b, offset) : (unsigned char)t->s[offset];
+}
+
+static bool textLineStart(const struct regexText *t, size_t offset) {
+    return offset == 0 ? t->lineStart : textByte(t, offset - 1) == '\n';
+}
+
+static bool textLineEnd(const struct regexText *t, size_t offset) {
+    return offset == t->length ? t->lineEnd : textByte(t, offset) == '\n';
+}
+
+/*
+ * Where the leftmost match starting at or after `from` ends. While no attempt is under way the
+ * literal prefix is searched for instead of stepping byte by byte, and once none is under way at
+ * `limit` (a line start or the end of the text) the search gives up.
+ */
+static bool scanForward(struct regexDfa *d, const struct regexText *t, size_t from, size_t limit, size_t *end) {
+    const struct searchPattern *prefix = &d->re->prefix;
+    int s = dfaStart(d, textLineStart(t, from));
+    bool found = false;
+    size_t offset = from;
+
+    while (offset < t->length) {
+        const char *chars;
+        size_t n = textChunk(t, offset, &chars);
+        if (n == 0) break;
+
+        for (size_t i = 0; i < n;) {
+            const struct regexState *st = &d->states[s];
+            if (st->start) {
+                if (offset + i >= limit) return false;
+                if (prefix->len > 0) {
+                    /* Skip to the next place the prefix occurs, or to where it could still straddle the piece end. */
+                    const char *hit = searchForward(prefix, chars + i, n - i);
+                    size_t to = hit ? (size_t)(hit - chars) : n - i >= prefix->len ? n - prefix->len + 1 : i;
+                    if (to > i) {
+                        i = to;
+                        if (i == n) break;
+                        s = dfaStart(d, chars[i - 1] == '\n');
+                        continue;
+                    }
+                }
+            }
+
+            /* Follow the transitions already known for as long as nothing happens on them. */
+            const int *next = d->next;
+            int row = s << DFA_SHIFT;
+            int transition;
+            while (((transition = next[row | (unsigned char)chars[i]]) & (DFA_MATCH | DFA_ALERT)) == 0) {
+                row = transition;
+                if (++i == n) break;
+            }
+            s = row >> DFA_SHIFT;
+            if (i == n) break;
+
+            if (transition == DFA_UNKNOWN) transition = dfaStep(d, s, (unsigned char)chars[i]);
+            if (transition & DFA_MATCH) {
+                *end = offset + i;
+                found = true;
+            }
+            s = transition >> DFA_SHIFT;
+            if (d->states[s].dead) return found;
+            i++;
+        }
+        offset += n;
+        if (d->states[s].start && offset < t->length) s = dfaStart(d, chars[n - 1] == '\n');
+    }
+    if (dfaFinal(d, s, t->lineEnd)) {
+        *end = t->length;
+        found = true;
+    }
+    return found;
+}
+
+/* Where the longest match ending at `end` starts, reading the reversed pattern back to no earlier than `from`. */
+static size_t scanBackward(struct regexDfa *d, const struct regexText *t, size_t from, size_t end) {
+    int s = dfaStart(d, textLineEnd(t, end));
+    size_t start = end;
+    size_t offset = end;
+
+    while (offset > from) {
+        const char *chars;
+        size_t n = textChunkBefore(t, offset, &chars);
+        if (n == 0) break;
+        if (n > offset - from) {
+            chars += n - (offset - from);
+            n = offset - from;
+        }
+
+        for (size_t i = n; i-- > 0;) {
+            int transition = dfaNext(d, s, (unsigned char)chars[i]);
+            if (transition & DFA_MATCH) start = offset - n + i + 1;
+            s = transition >> DFA_SHIFT;
+            if (d->states[s].dead) return start;
+        }
+        offset -= n;
+    }
+
+    /* At `from` the byte before it decides whether a ^ holds. */
+    if (from > 0) {
+        if (dfaNext(d, s, (unsigned char)textByte(t, from - 1)) & DFA_MATCH) start = from;
+    } else if (dfaFinal(d, s, t->lineStart)) {
+        start = from;
+    }
+    return start;
+}
+
+static bool textForward(struct regexMatcher *m, const struct regexText *t, size_t from, size_t limit,
+                        size_t *start, size_t *end) {
+    if (!scanForward(&m->leftmost, t, from, limit, end)) return false;
+    *start = scanBackward(&m->reverse, t, from, *end);
+    return *start < limit;
+}
+
+/*
+ * The leftmost match starting in [from, limit), where `limit` is a line start or the end of the
+ * buffer. The DFA runs across piece boundaries, so nothing needs stitching together.
+ */
+bool regexBufferForward(struct regexMatcher *m, const struct textBuffer *b, size_t from, size_t limit,
+                        size_t *start, size_t *end) {
+    struct regexText t = {b, NULL, bufferLength(b), true, true};
+    return textForward(m, &t, from, limit, start, end);
+}
+
+/*
+ * The last match starting before `before`, taking matches the way a forward search does: leftmost
+ * first and then on from the end of each one. Growing stretches of whole lines are searched
+ * until one has a match.
+ */
+bool regexBufferBackward(struct regexMatcher *m, const struct textBuffer *b, size_t before, size_t *start) {
+    size_t length = bufferLength(b);
+    size_t lines = bufferLineCount(b);
+    size_t span = REGEX_BACK_SPAN;
+    size_t hi = before;
+
+    while (hi > 0) {
+        size_t lo = bufferLineStart(b, bufferLineOf(b, hi > span ? hi - span : 0));
+        size_t line = bufferLineOf(b, hi);
+        size_t limit = line + 1 < lines ? bufferLineStart(b, line + 1) : length;
+
+        bool found = false;
+        size_t match, end;
+        for (size_t from = lo; regexBufferForward(m, b, from, limit, &match, &end) && match < hi; from = end) {
+            *start = match;
+            found = true;
+        }
+        if (found) return true;
+        hi = lo;
+        span *= 2;
+    }
+    return false;
+}
+
+/* The leftmost match in s[0, n), which starts a line if `lineStart` and ends one if `lineEnd`. */
+bool regexForward(struct regexMatcher *m, const char *s, size_t n, bool lineStart, bool lineEnd,
+                  size_t *start, size_t *end) {
+    struct regexText t = {NULL, s, n, lineStart, lineEnd};
+    return textForward(m, &t, 0, n, start, end);
+}
+
+/*
+ * Length of the match known to start at `s`. If it is still going where the bytes run out
+ * mid-line, it is taken to run to the end of them.
+ */
+size_t regexLength(struct regexMatcher *m, const char *s, size_t n, bool lineStart, bool lineEnd) {
+    struct regexDfa *d = &m->anchored;
+    int state = dfaStart(d, lineStart);
+    size_t end = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        int transition = dfaNext(d, state, (unsigned char)s[i]);
+        if (transition & DFA_MATCH) end = i;
+        state = transition >> DFA_SHIFT;
+        if (d->states[state].dead) return end;
+    }
+    if (!lineEnd) return n;
+    return dfaFinal(d, state, true) ? n : end;
+}
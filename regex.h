@@ -0,0 +1,96 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "buffer.h"
+#include "search.h"
+
+/* Longest pattern accepted once counted repetitions are expanded, in program instructions. */
+#define REGEX_PROGRAM_MAX 20000
+
+/* States a lazy DFA keeps before it throws them all away and starts building again. */
+#define REGEX_STATES_MAX 1024
+
+enum regexOp {
+    REGEX_CLASS,
+    REGEX_SPLIT,
+    REGEX_BOL,
+    REGEX_EOL,
+    REGEX_MATCH
+};
+
+/* One instruction of a Thompson NFA; a SPLIT prefers `next` over `alt`. */
+struct regexInst {
+    int op;
+    int next, alt;
+    int set;
+};
+
+struct regexProgram {
+    struct regexInst *insts;
+    int count, cap;
+    int start;
+};
+
+/*
+ * A compiled pattern: the program run forward to find where the leftmost match ends, the same
+ * pattern reversed to walk back to where it starts, and the literal every match begins with,
+ * which is searched for with the plain-text matcher while no match is under way.
+ */
+struct regex {
+    struct regexProgram forward, reverse;
+    unsigned char (*sets)[32];
+    int setCount, setCap;
+    struct searchPattern prefix;
+};
+
+/* A DFA state: the NFA instructions it stands for, kept in the pool. */
+struct regexState {
+    int first, count;
+    unsigned flags;
+    int atEnd;
+    bool start, dead;
+};
+
+/*
+ * A DFA built lazily from one program as the text asks for states; `next` holds 256 transitions
+ * per state, worked out the first time each byte is read. Not shared between threads.
+ */
+struct regexDfa {
+    const struct regex *re;
+    const struct regexProgram *program;
+    int mode;
+    struct regexState *states;
+    int *next;
+    int stateCount, stateCap;
+    int *pool;
+    size_t poolLen, poolCap;
+    int *table;
+    int tableCap;
+    int starts[2];
+    int *list, *stack;
+    unsigned *mark;
+    unsigned generation;
+};
+
+/* The DFAs one thread needs to find matches and measure them. */
+struct regexMatcher {
+    struct regexDfa leftmost, anchored, reverse;
+};
+
+int regexCompile(struct regex *re, const char *pattern, size_t len, const char **error);
+void regexFree(struct regex *re);
+
+void regexMatcherInit(struct regexMatcher *m, const struct regex *re);
+void regexMatcherFree(struct regexMatcher *m);
+
+bool regexBufferForward(struct regexMatcher *m, const struct textBuffer *b, size_t from, size_t limit,
+                        size_t *start, size_t *end);
+bool regexBufferBackward(struct regexMatcher *m, const struct textBuffer *b, size_t before, size_t *start);
+bool regexForward(struct regexMatcher *m, const char *s, size_t n, bool lineStart, bool lineEnd,
+                  size_t *start, size_t *end);
+size_t regexLength(struct regexMatcher *m, const char *s, size_t n, bool lineStart, bool lineEnd);
+
+#endif
@@ -0,0 +1,410 @@
+/* stat's st_mtim, strndup and strdup are POSIX; Darwin hides st_mtimespec unless asked for its own extensions too. */
+#define _POSIX_C_SOURCE 200809L
+#if defined(__APPLE__)
+    #define _DARWIN_C_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #if defined(__linux__)
+        #include <sys/inotify.h>
+    #endif
+#else
+    #include <sys/types.h>
+    #include <sys/stat.h>
+#endif
+
+#include "reload.h"
+
+/* Text that survived a rewrite is found in blocks of this size; each changed spot costs about one block. */
+#define RELOAD_BLOCK 4096
+
+/*
+ * After a difference, matching blocks are looked for this far ahead first, then four times as far
+ * and so on up to RELOAD_WINDOW_MAX. Past that the change is big enough that loading it is cheaper.
+ */
+#define RELOAD_WINDOW ((size_t)256 << 10)
+#define RELOAD_WINDOW_MAX ((size_t)4 << 20)
+
+#define NO_BLOCK ((size_t)-1)
+
+int stampGet(const char *filename, struct fileStamp *stamp) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    struct stat st;
+    if (stat(filename, &st) == -1) return -1;
+    #if defined(__APPLE__)
+        stamp->mtimeNsec = st.st_mtimespec.tv_nsec;
+    #else
+        stamp->mtimeNsec = st.st_mtim.tv_nsec;
+    #endif
+#else
+    struct _stat64 st;
+    if (_stat64(filename, &st) == -1) return -1;
+    stamp->mtimeNsec = 0;
+#endif
+    stamp->dev = st.st_dev;
+    stamp->ino = st.st_ino;
+    stamp->size = st.st_size;
+    stamp->mtime = st.st_mtime;
+    return 0;
+}
+
+static bool stampEqual(const struct fileStamp *a, const struct fileStamp *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+           a->mtime == b->mtime && a->mtimeNsec == b->mtimeNsec;
+}
+
+/*
+ * Starts watching `filename` as it is now. On Linux inotify on the containing directory says when
+ * to look, which also catches the file being replaced by a rename; elsewhere every check stats it.
+ */
+int watchStart(struct fileWatch *w, const char *filename) {
+    memset(w, 0, sizeof(*w));
+    if (stampGet(filename, &w->opened) == -1) return -1;
+    w->stamp = w->opened;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    w->inotify = -1;
+    #if defined(__linux__)
+        w->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (w->inotify != -1) {
+            const char *slash = strrchr(filename, '/');
+            char *dir = slash ? strndup(filename, slash - filename + 1) : strdup(".");
+            uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB;
+            if (inotify_add_watch(w->inotify, dir, mask) == -1) {
+                close(w->inotify);
+                w->inotify = -1;
+            }
+            free(dir);
+        }
+    #endif
+#endif
+    w->active = true;
+    return 0;
+}
+
+void watchStop(struct fileWatch *w) {
+    if (!w->active) return;
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (w->inotify != -1) close(w->inotify);
+#endif
+    w->active = false;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static bool watchEvents(struct fileWatch *w) {
+    if (w->inotify == -1) return true;
+
+    bool any = false;
+    char events[4096];
+    while (read(w->inotify, events, sizeof(events)) > 0) any = true;
+    return any;
+}
+#endif
+
+/* Takes the file as it is now as the version the buffer holds, after we saved or reloaded it ourselves. */
+void watchReset(struct fileWatch *w, const char *filename) {
+    if (!w->active) return;
+#if !defined(_WIN32) && !defined(_WIN64)
+    watchEvents(w);
+#endif
+    stampGet(filename, &w->stamp);
+}
+
+/* True once per change of the file on disk. A file that can't be stat'ed, say mid-replace, counts as unchanged. */
+bool watchChanged(struct fileWatch *w, const char *filename) {
+    if (!w->active) return false;
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (!watchEvents(w)) return false;
+#endif
+
+    struct fileStamp stamp;
+    if (stampGet(filename, &stamp) == -1 || stampEqual(&stamp, &w->stamp)) return false;
+    w->stamp = stamp;
+    return true;
+}
+
+/*
+ * True if the file was rewritten in place rather than replaced. A mapped original then shows
+ * the new bytes, or faults past a shorter end, so it can't be diffed against.
+ */
+bool watchSameFile(const struct fileWatch *w) {
+    return w->stamp.dev == w->opened.dev && w->stamp.ino == w->opened.ino;
+}
+
+int reloadRead(struct reloadFile *f, const char *filename) {
+    memset(f, 0, sizeof(*f));
+#if !defined(_WIN32) && !defined(_WIN64)
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size > 0) {
+        void *chars = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (chars == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        f->chars = (char *)chars;
+        f->size = st.st_size;
+        f->mapped = true;
+    }
+    close(fd);
+    return 0;
+#else
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return -1;
+
+    __int64 size = -1;
+    if (_fseeki64(fp, 0, SEEK_END) == 0) size = _ftelli64(fp);
+    if (size < 0 || _fseeki64(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+    f->chars = (char *)malloc(size ? (size_t)size : 1);
+    f->size = fread(f->chars, 1, (size_t)size, fp);
+    fclose(fp);
+    return 0;
+#endif
+}
+
+void reloadClose(struct reloadFile *f) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (f->mapped) {
+        munmap(f->chars, f->size);
+    } else {
+        free(f->chars);
+    }
+#else
+    free(f->chars);
+#endif
+    memset(f, 0, sizeof(*f));
+}
+
+static size_t sameBytes(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        size_t step = n - i < RELOAD_BLOCK ? n - i : RELOAD_BLOCK;
+        if (memcmp(a + i, b + i, step) != 0) break;
+        i += step;
+    }
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+/* Same as sameBytes, walking back from the ends `a` and `b`. */
+static size_t sameBytesBack(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    while (i < n) {
+        size_t step = n - i < RELOAD_BLOCK ? n - i : RELOAD_BLOCK;
+        if (memcmp(a - i - step, b - i - step, step) != 0) break;
+        i += step;
+    }
+    while (i < n && a[-1 - (long)i] == b[-1 - (long)i]) i++;
+    return i;
+}
+
+/* Common start of the old text from `offset` and `s`. */
+static size_t commonPrefix(const struct textBuffer *b, size_t offset, const char *s, size_t limit) {
+    size_t done = 0, len;
+    const char *chars;
+    while (done < limit && (len = bufferChunk(b, offset + done, &chars)) > 0) {
+        if (len > limit - done) len = limit - done;
+        size_t same = sameBytes(chars, s + done, len);
+        done += same;
+        if (same < len) break;
+    }
+    return done;
+}
+
+/* Common end of the old text before `offset` and the new text before `end`. */
+static size_t commonSuffix(const struct textBuffer *b, size_t offset, const char *end, size_t limit) {
+    size_t done = 0, len;
+    const char *chars;
+    while (done < limit && (len = bufferChunkBefore(b, offset - done, &chars)) > 0) {
+        size_t n = len < limit - done ? len : limit - done;
+        size_t same = sameBytesBack(chars + len, end - done, n);
+        done += same;
+        if (same < n) break;
+    }
+    return done;
+}
+
+/* The rsync weak checksum: cheap to slide along the new text one byte at a time. */
+struct rollSum {
+    uint32_t a, b;
+};
+
+static void rollInit(struct rollSum *r, const unsigned char *s, size_t n) {
+    r->a = 0;
+    r->b = 0;
+    for (size_t i = 0; i < n; i++) {
+        r->a += s[i];
+        r->b += (uint32_t)(n - i) * s[i];
+    }
+}
+
+static void rollStep(struct rollSum *r, unsigned char out, unsigned char in, size_t n) {
+    r->a += in - out;
+    r->b += r->a - (uint32_t)n * out;
+}
+
+static uint32_t rollDigest(const struct rollSum *r) {
+    return (r->a & 0xffff) | (r->b << 16);
+}
+
+/* Digests of the old blocks, open addressed by digest. Slots hold a block number plus one. */
+struct blockTable {
+    uint32_t *digests;
+    size_t *slots;
+    size_t mask;
+};
+
+static void blockTableBuild(struct blockTable *t, const struct textBuffer *b, size_t base, size_t blocks) {
+    size_t cap = 16;
+    while (cap < blocks * 2) cap *= 2;
+    t->digests = (uint32_t *)malloc(blocks * sizeof(uint32_t));
+    t->slots = (size_t *)calloc(cap, sizeof(size_t));
+    t->mask = cap - 1;
+
+    unsigned char block[RELOAD_BLOCK];
+    for (size_t k = 0; k < blocks; k++) {
+        bufferRead(b, base + k * RELOAD_BLOCK, (char *)block, RELOAD_BLOCK);
+        struct rollSum r;
+        rollInit(&r, block, RELOAD_BLOCK);
+        t->digests[k] = rollDigest(&r);
+
+        size_t slot = (t->digests[k] * 2654435761u) & t->mask;
+        while (t->slots[slot]) slot = (slot + 1) & t->mask;
+        t->slots[slot] = k + 1;
+    }
+}
+
+/* Lowest block whose digest is `digest`. */
+static size_t blockTableFind(const struct blockTable *t, uint32_t digest) {
+    size_t found = NO_BLOCK;
+    for (size_t slot = (digest * 2654435761u) & t->mask; t->slots[slot]; slot = (slot + 1) & t->mask) {
+        size_t k = t->slots[slot] - 1;
+        if (t->digests[k] == digest && k < found) found = k;
+    }
+    return found;
+}
+
+static void blockTableFree(struct blockTable *t) {
+    free(t->digests);
+    free(t->slots);
+}
+
+struct editList {
+    struct reloadEdit *edits;
+    size_t count, cap;
+};
+
+static void editPush(struct editList *list, size_t offset, size_t removed, const char *chars, size_t inserted) {
+    if (removed == 0 && inserted == 0) return;
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->edits = (struct reloadEdit *)realloc(list->edits, list->cap * sizeof(struct reloadEdit));
+    }
+    struct reloadEdit *e = &list->edits[list->count++];
+    e->offset = offset;
+    e->removed = removed;
+    e->chars = chars;
+    e->inserted = inserted;
+}
+
+/*
+ * Finds where the old text at `base` and `s` agree again after differing at their start, the way
+ * rsync does: the old text is cut into blocks, a rolling checksum slides over the new text, and the
+ * first verified hit gives how much of each side to skip. The search widens step by step, so its
+ * cost follows the size of the change rather than of the file.
+ */
+static bool resync(const struct textBuffer *b, size_t base, size_t oldLen, const char *s, size_t newLen,
+                   size_t *skipOld, size_t *skipNew) {
+    const unsigned char *u = (const unsigned char *)s;
+    char block[RELOAD_BLOCK];
+
+    for (size_t window = RELOAD_WINDOW; window <= RELOAD_WINDOW_MAX; window *= 4) {
+        size_t oldN = oldLen < window ? oldLen : window;
+        size_t newN = newLen < window ? newLen : window;
+        if (oldN < RELOAD_BLOCK || newN < RELOAD_BLOCK) return false;
+
+        struct blockTable t;
+        blockTableBuild(&t, b, base, oldN / RELOAD_BLOCK);
+
+        struct rollSum r;
+        rollInit(&r, u, RELOAD_BLOCK);
+        for (size_t p = 0; p + RELOAD_BLOCK <= newN; p++) {
+            if (p > 0) rollStep(&r, u[p - 1], u[p + RELOAD_BLOCK - 1], RELOAD_BLOCK);
+
+            size_t k = blockTableFind(&t, rollDigest(&r));
+            if (k == NO_BLOCK) continue;
+            bufferRead(b, base + k * RELOAD_BLOCK, block, RELOAD_BLOCK);
+            if (memcmp(block, s + p, RELOAD_BLOCK) != 0) continue;
+
+            blockTableFree(&t);
+            *skipOld = k * RELOAD_BLOCK;
+            *skipNew = p;
+            return true;
+        }
+        blockTableFree(&t);
+        if (oldN == oldLen && newN == newLen) return false;
+    }
+    return false;
+}
+
+/*
+ * Edits that turn the old text [base, base + oldLen) into `s`. Equal stretches are skipped with
+ * memcmp; only where the two differ does resync have to look for the next common block.
+ */
+static void diffRange(const struct textBuffer *b, size_t base, size_t oldLen, const char *s, size_t newLen,
+                      struct editList *list) {
+    size_t oldPos = 0, newPos = 0;
+    while (true) {
+        size_t limit = oldLen - oldPos < newLen - newPos ? oldLen - oldPos : newLen - newPos;
+        size_t same = commonPrefix(b, base + oldPos, s + newPos, limit);
+        oldPos += same;
+        newPos += same;
+        if (oldPos == oldLen || newPos == newLen) break;
+
+        size_t skipOld, skipNew;
+        if (!resync(b, base + oldPos, oldLen - oldPos, s + newPos, newLen - newPos, &skipOld, &skipNew)) break;
+
+        /* The hit sits on a block boundary of the old text; whatever agrees just before it stays too. */
+        size_t shorter = skipOld < skipNew ? skipOld : skipNew;
+        size_t back = commonSuffix(b, base + oldPos + skipOld, s + newPos + skipNew, shorter);
+        editPush(list, base + oldPos, skipOld - back, s + newPos, skipNew - back);
+        oldPos += skipOld;
+        newPos += skipNew;
+    }
+    editPush(list, base + oldPos, oldLen - oldPos, s + newPos, newLen - newPos);
+}
+
+/*
+ * Edits that turn the text of `b` into the contents of `f`, in increasing order of old offset.
+ * The common end is taken off first so growing windows never have to search through it.
+ */
+size_t reloadDiff(const struct textBuffer *b, const struct reloadFile *f, struct reloadEdit **edits) {
+    const char *s = f->chars ? f->chars : "";
+    size_t oldLen = bufferLength(b);
+    size_t shorter = oldLen < f->size ? oldLen : f->size;
+
+    size_t suffix = commonSuffix(b, oldLen, s + f->size, shorter);
+
+    struct editList list = {0};
+    diffRange(b, 0, oldLen - suffix, s, f->size - suffix, &list);
+    *edits = list.edits;
+    return list.count;
+}
@@ -0,0 +1,55 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "buffer.h"
+
+/* What tells one version of a file on disk from the next. */
+struct fileStamp {
+    unsigned long long dev, ino;
+    long long size;
+    long long mtime, mtimeNsec;
+};
+
+/*
+ * Notices when the file behind the buffer is rewritten by another process. `opened` is the file
+ * the original buffer came from, `stamp` the version last seen.
+ */
+struct fileWatch {
+    bool active;
+    struct fileStamp opened;
+    struct fileStamp stamp;
+#if !defined(_WIN32) && !defined(_WIN64)
+    int inotify;
+#endif
+};
+
+/* The new contents of a changed file, mapped or read whole. */
+struct reloadFile {
+    char *chars;
+    size_t size;
+    bool mapped;
+};
+
+/* Replaces the old bytes [offset, offset + removed) with `inserted` bytes from `chars`. */
+struct reloadEdit {
+    size_t offset, removed;
+    const char *chars;
+    size_t inserted;
+};
+
+int stampGet(const char *filename, struct fileStamp *stamp);
+
+int watchStart(struct fileWatch *w, const char *filename);
+void watchStop(struct fileWatch *w);
+void watchReset(struct fileWatch *w, const char *filename);
+bool watchChanged(struct fileWatch *w, const char *filename);
+bool watchSameFile(const struct fileWatch *w);
+
+int reloadRead(struct reloadFile *f, const char *filename);
+void reloadClose(struct reloadFile *f);
+size_t reloadDiff(const struct textBuffer *b, const struct reloadFile *f, struct reloadEdit **edits);
+
+#endif
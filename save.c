@@ -0,0 +1,277 @@
+/* clock_gettime, writev, fsync and strndup are POSIX rather than C99, and realpath is from its XSI part. */
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <windows.h>
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <limits.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+    #include <sys/uio.h>
+#endif
+
+#include "save.h"
+
+#if !defined(IOV_MAX)
+    #define IOV_MAX 1024
+#endif
+
+/* Long spans are written in slices of this size so progress keeps moving through one large piece. */
+#define SAVE_SLICE ((size_t)4 << 20)
+
+static double saveClock() {
+#if defined(_WIN32) || defined(_WIN64)
+    return GetTickCount64() / 1000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/* Feeds the snapshot through an encoder, which compresses it for .gz and .zst targets and passes plain text through. */
+static int saveEncoded(struct saveJob *job, int (*sink)(void *, const char *, size_t), void *ctx) {
+    struct encoder e;
+    int result = encoderInit(&e, job->format, sink, ctx);
+    if (result == -1) errno = EIO;
+
+    for (size_t i = 0; i < job->spanCount && result == 0; i++) {
+        const char *chars = job->spans[i].chars;
+        size_t len = job->spans[i].len;
+        while (len > 0 && result == 0) {
+            size_t n = len < SAVE_SLICE ? len : SAVE_SLICE;
+            result = encoderWrite(&e, chars, n);
+            __atomic_add_fetch(&job->written, n, __ATOMIC_RELAXED);
+            chars += n;
+            len -= n;
+        }
+    }
+    if (result == 0) result = encoderFinish(&e);
+    encoderFree(&e);
+    return result;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+/* Writes every iovec completely, resuming after short writes. */
+static int writeAll(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* Hands the snapshot to the kernel straight out of the original and add buffers, IOV_MAX spans per call. */
+static int saveSpans(struct saveJob *job, int fd) {
+    struct iovec iov[IOV_MAX];
+    int count = 0;
+    size_t batch = 0;
+
+    for (size_t i = 0; i < job->spanCount; i++) {
+        const char *chars = job->spans[i].chars;
+        size_t len = job->spans[i].len;
+        while (len > 0) {
+            size_t n = len < SAVE_SLICE - batch ? len : SAVE_SLICE - batch;
+            iov[count].iov_base = (void *)chars;
+            iov[count].iov_len = n;
+            count++;
+            batch += n;
+            chars += n;
+            len -= n;
+
+            if (count == IOV_MAX || batch == SAVE_SLICE) {
+                if (writeAll(fd, iov, count) == -1) return -1;
+                __atomic_add_fetch(&job->written, batch, __ATOMIC_RELAXED);
+                count = 0;
+                batch = 0;
+            }
+        }
+    }
+    if (writeAll(fd, iov, count) == -1) return -1;
+    __atomic_add_fetch(&job->written, batch, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int fdSink(void *ctx, const char *chars, size_t len) {
+    struct iovec iov = { (void *)chars, len };
+    return writeAll(*(int *)ctx, &iov, 1);
+}
+
+static void syncDirectory(const char *path, size_t dirLen) {
+    char *dir = dirLen ? strndup(path, dirLen) : strdup(".");
+    int fd = open(dir, O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+/*
+ * Writes the snapshot to a temporary file next to the target, syncs it and renames it over the
+ * target, so a crash leaves either the old or the new contents. A mapped original stays valid
+ * because the old inode is only unlinked, never truncated.
+ */
+static int saveFile(struct saveJob *job) {
+    char *target = realpath(job->filename, NULL);
+    const char *path = target ? target : job->filename;
+    const char *slash = strrchr(path, '/');
+    size_t dirLen = slash ? (size_t)(slash - path) + 1 : 0;
+
+    size_t tempLen = strlen(path) + 16;
+    char *temp = (char *)malloc(tempLen);
+    snprintf(temp, tempLen, "%.*s.%s.XXXXXX", (int)dirLen, path, path + dirLen);
+
+    int fd = mkstemp(temp);
+    if (fd == -1) {
+        free(temp);
+        free(target);
+        return -1;
+    }
+
+    struct stat st;
+    mode_t mode;
+    if (stat(path, &st) == 0) {
+        mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        mode = 0666 & ~mask;
+    }
+
+    int result = -1;
+    if (fchmod(fd, mode) == 0 &&
+        (job->format == COMPRESS_NONE ? saveSpans(job, fd) : saveEncoded(job, fdSink, &fd)) == 0 &&
+        fsync(fd) == 0) result = 0;
+    if (close(fd) == -1) result = -1;
+    if (result == 0 && rename(temp, path) == -1) result = -1;
+
+    if (result == -1) {
+        int err = errno;
+        unlink(temp);
+        errno = err;
+    } else {
+        syncDirectory(path, dirLen);
+    }
+    free(temp);
+    free(target);
+    return result;
+}
+#else
+static int fileSink(void *ctx, const char *chars, size_t len) {
+    return fwrite(chars, 1, len, (FILE *)ctx) == len ? 0 : -1;
+}
+
+/* Same contract as the POSIX version: write a sibling file, flush it to disk, then swap it in. */
+static int saveFile(struct saveJob *job) {
+    size_t tempLen = strlen(job->filename) + 8;
+    char *temp = (char *)malloc(tempLen);
+    snprintf(temp, tempLen, "%s.saving", job->filename);
+
+    FILE *fp = fopen(temp, "wb");
+    if (!fp) {
+        free(temp);
+        return -1;
+    }
+
+    int result = saveEncoded(job, fileSink, fp);
+    if (fflush(fp) != 0 || _commit(_fileno(fp)) != 0) result = -1;
+    if (fclose(fp) != 0) result = -1;
+    if (result == 0 && !MoveFileExA(temp, job->filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        errno = EACCES;
+        result = -1;
+    }
+
+    if (result == -1) remove(temp);
+    free(temp);
+    return result;
+}
+#endif
+
+static void *saveThread(void *arg) {
+    struct saveJob *job = (struct saveJob *)arg;
+    double start = saveClock();
+
+    job->result = saveFile(job);
+    job->error = job->result == -1 ? errno : 0;
+    job->stats.bytes = job->total;
+    job->stats.seconds = saveClock() - start;
+    __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* Snapshots the spans of `b` and writes them to `filename` in `format` on a writer thread, or inline where there is none. */
+void saveStart(struct saveJob *job, const struct textBuffer *b, const char *filename, enum compressFormat format) {
+    saveWait(job);
+    free(job->spans);
+    free(job->filename);
+    memset(job, 0, sizeof(*job));
+
+    job->filename = strdup(filename);
+    job->format = format;
+    job->total = bufferLength(b);
+
+    size_t cap = 0;
+    size_t offset = 0, len;
+    const char *chars;
+    while ((len = bufferChunk(b, offset, &chars)) > 0) {
+        if (job->spanCount == cap) {
+            cap = cap ? cap * 2 : 64;
+            job->spans = (struct saveSpan *)realloc(job->spans, cap * sizeof(struct saveSpan));
+        }
+        job->spans[job->spanCount].chars = chars;
+        job->spans[job->spanCount].len = len;
+        job->spanCount++;
+        offset += len;
+    }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    job->running = true;
+    if (pthread_create(&job->writer, NULL, saveThread, job) == 0) return;
+    job->running = false;
+#endif
+    saveThread(job);
+}
+
+/* True while the writer is busy; once it is done it has been joined and the result fields are final. */
+bool saveRunning(struct saveJob *job) {
+    if (job->running && __atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+        saveWait(job);
+    }
+    return job->running;
+}
+
+void saveWait(struct saveJob *job) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (job->running) {
+        pthread_join(job->writer, NULL);
+        job->running = false;
+    }
+#endif
+}
+
+int saveProgress(const struct saveJob *job) {
+    if (job->total == 0) return 100;
+    return (int)(__atomic_load_n(&job->written, __ATOMIC_RELAXED) * 100 / job->total);
+}
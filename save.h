@@ -0,0 +1,50 @@
+#ifndef SAVE_H
+#define SAVE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <pthread.h>
+#endif
+
+#include "buffer.h"
+#include "compress.h"
+
+struct saveSpan {
+    const char *chars;
+    size_t len;
+};
+
+struct saveStats {
+    size_t bytes;
+    double seconds;
+};
+
+/*
+ * A save in flight. The spans point into the original and add buffers, which never change
+ * bytes already written, so the writer needs no lock while the buffer keeps being edited.
+ */
+struct saveJob {
+    struct saveSpan *spans;
+    size_t spanCount;
+    char *filename;
+    enum compressFormat format;
+    size_t total;
+    size_t written;
+    bool running;
+    bool done;
+    int result;
+    int error;
+    struct saveStats stats;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_t writer;
+#endif
+};
+
+void saveStart(struct saveJob *job, const struct textBuffer *b, const char *filename, enum compressFormat format);
+bool saveRunning(struct saveJob *job);
+void saveWait(struct saveJob *job);
+int saveProgress(const struct saveJob *job);
+
+#endif
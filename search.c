@@ -0,0 +1,698 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#include "search.h"
+#include "regex.h"
+
+/* Queries matching more often than this are not indexed; callers fall back to searching the buffer. */
+#define MATCH_INDEX_MAX ((size_t)1 << 22)
+
+/* Patterns at least this long skip far enough per step that Horspool beats the 16-byte filter. */
+#define SEARCH_SKIP_MIN 128
+
+/* A search job hands out the text in chunks of this size; it bounds how long cancelling takes. */
+#define SEARCH_CHUNK ((size_t)4 << 20)
+
+void searchCompile(struct searchPattern *p, const char *s, size_t len) {
+    p->chars = (char *)malloc(len + 1);
+    memcpy(p->chars, s, len);
+    p->chars[len] = '\0';
+    p->len = len;
+    p->seam = (char *)malloc(len ? 2 * (len - 1) + 1 : 1);
+    p->re = NULL;
+    p->matcher = NULL;
+
+    for (int c = 0; c < 256; c++) {
+        p->skip[c] = len;
+        p->skipBack[c] = len;
+    }
+    for (size_t i = 0; i + 1 < len; i++) {
+        p->skip[(unsigned char)s[i]] = len - 1 - i;
+    }
+    for (size_t i = len; i-- > 1;) {
+        p->skipBack[(unsigned char)s[i]] = i;
+    }
+}
+
+/* Compiles `s` as a regular expression; on failure `p` is left empty and `error` says why. */
+int searchCompileRegex(struct searchPattern *p, const char *s, size_t len, const char **error) {
+    struct regex *re = (struct regex *)malloc(sizeof(struct regex));
+    if (regexCompile(re, s, len, error) == -1) {
+        free(re);
+        memset(p, 0, sizeof(*p));
+        return -1;
+    }
+    searchCompile(p, s, len);
+    p->re = re;
+    p->matcher = (struct regexMatcher *)malloc(sizeof(struct regexMatcher));
+    regexMatcherInit(p->matcher, re);
+    return 0;
+}
+
+void searchFree(struct searchPattern *p) {
+    if (p->re) {
+        regexMatcherFree(p->matcher);
+        regexFree(p->re);
+        free(p->matcher);
+        free(p->re);
+    }
+    free(p->chars);
+    free(p->seam);
+    memset(p, 0, sizeof(*p));
+}
+
+static const char *horspoolForward(const struct searchPattern *p, const char *s, size_t n) {
+    size_t m = p->len;
+    unsigned char last = p->chars[m - 1];
+
+    for (size_t i = 0; i + m <= n;) {
+        unsigned char c = s[i + m - 1];
+        if (c == last && memcmp(s + i, p->chars, m - 1) == 0) return s + i;
+        i += p->skip[c];
+    }
+    return NULL;
+}
+
+static const char *horspoolBackward(const struct searchPattern *p, const char *s, size_t n) {
+    size_t m = p->len;
+    unsigned char first = p->chars[0];
+    if (n < m) return NULL;
+
+    for (size_t i = n - m;;) {
+        unsigned char c = s[i];
+        if (c == first && memcmp(s + i + 1, p->chars + 1, m - 1) == 0) return s + i;
+        if (i < p->skipBack[c]) return NULL;
+        i -= p->skipBack[c];
+    }
+}
+
+#if defined(__SSE2__)
+/* Candidate positions among the 16 windows starting at `s`: first and last byte both match. */
+static unsigned filterMask(const struct searchPattern *p, const char *s) {
+    __m128i first = _mm_set1_epi8(p->chars[0]);
+    __m128i last = _mm_set1_epi8(p->chars[p->len - 1]);
+    __m128i a = _mm_loadu_si128((const __m128i *)s);
+    __m128i b = _mm_loadu_si128((const __m128i *)(s + p->len - 1));
+    return (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+}
+
+static bool filterVerify(const struct searchPattern *p, const char *s) {
+    return p->len <= 2 || memcmp(s + 1, p->chars + 1, p->len - 2) == 0;
+}
+
+static const char *filterForward(const struct searchPattern *p, const char *s, size_t n) {
+    size_t m = p->len;
+    size_t i = 0;
+
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        unsigned mask = filterMask(p, s + i);
+        while (mask) {
+            const char *at = s + i + __builtin_ctz(mask);
+            if (filterVerify(p, at)) return at;
+            mask &= mask - 1;
+        }
+    }
+    return horspoolForward(p, s + i, n - i);
+}
+
+static const char *filterBackward(const struct searchPattern *p, const char *s, size_t n) {
+    size_t m = p->len;
+    if (n < m) return NULL;
+
+    /* Windows starting in [0, starts) remain to be checked. */
+    size_t starts = n - m + 1;
+    for (; starts >= 16; starts -= 16) {
+        unsigned mask = filterMask(p, s + starts - 16);
+        while (mask) {
+            int bit = 31 - __builtin_clz(mask);
+            const char *at = s + starts - 16 + bit;
+            if (filterVerify(p, at)) return at;
+            mask &= ~(1u << bit);
+        }
+    }
+    return horspoolBackward(p, s, starts + m - 1);
+}
+#endif
+
+/* First occurrence entirely inside s[0, n). */
+const char *searchForward(const struct searchPattern *p, const char *s, size_t n) {
+    if (p->len == 0 || n < p->len) return NULL;
+    if (p->len == 1) return (const char *)memchr(s, p->chars[0], n);
+#if defined(__SSE2__)
+    if (p->len < SEARCH_SKIP_MIN) return filterForward(p, s, n);
+#endif
+    return horspoolForward(p, s, n);
+}
+
+/* Last occurrence entirely inside s[0, n). */
+const char *searchBackward(const struct searchPattern *p, const char *s, size_t n) {
+    if (p->len == 0 || n < p->len) return NULL;
+#if defined(__SSE2__)
+    if (p->len < SEARCH_SKIP_MIN) return filterBackward(p, s, n);
+#endif
+    return horspoolBackward(p, s, n);
+}
+
+/*
+ * First match in s[0, n) and its length, for text on screen; `lineStart` and `lineEnd` say whether
+ * the bytes begin and end a line, which a regular expression's ^ and $ depend on.
+ */
+const char *searchText(const struct searchPattern *p, const char *s, size_t n, bool lineStart, bool lineEnd, size_t *len) {
+    if (p->re == NULL) {
+        *len = p->len;
+        return searchForward(p, s, n);
+    }
+    size_t start, end;
+    if (!regexForward(p->matcher, s, n, lineStart, lineEnd, &start, &end)) return NULL;
+    *len = end - start;
+    return s + start;
+}
+
+/* Length of the match known to start at `s`, cut short where the bytes end mid-line. */
+size_t searchLength(const struct searchPattern *p, const char *s, size_t n, bool lineStart, bool lineEnd) {
+    if (p->re == NULL) return p->len;
+    return regexLength(p->matcher, s, n, lineStart, lineEnd);
+}
+
+/* How many bytes past a stretch of text a match starting in it can run. */
+size_t searchReach(const struct searchPattern *p) {
+    if (p->re) return SEARCH_REGEX_REACH;
+    return p->len > 0 ? p->len - 1 : 0;
+}
+
+/* Keeps the last len-1 bytes seen in `seam`, to be joined with the head of the next piece. */
+static void seamCarry(char *seam, size_t *carry, size_t keep, const char *chars, size_t n) {
+    if (n >= keep) {
+        memcpy(seam, chars + n - keep, keep);
+        *carry = keep;
+    } else {
+        memcpy(seam + *carry, chars, n);
+        *carry += n;
+        if (*carry > keep) {
+            memmove(seam, seam + *carry - keep, keep);
+            *carry = keep;
+        }
+    }
+}
+
+/*
+ * First match starting at or after `from` and ending by `limit`. Pieces are searched in place;
+ * a match that straddles a piece boundary is found in `seam`, which joins the last len-1 bytes
+ * seen with the head of the next piece.
+ */
+static bool searchRange(const struct searchPattern *p, const struct textBuffer *b, size_t from, size_t limit,
+                        char *seam, size_t *match) {
+    if (p->len == 0) return false;
+
+    size_t keep = p->len - 1;
+    size_t carry = 0;
+    size_t offset = from;
+
+    while (offset < limit) {
+        const char *chars;
+        size_t n = bufferChunk(b, offset, &chars);
+        if (n == 0) break;
+        if (n > limit - offset) n = limit - offset;
+
+        size_t head = n < keep ? n : keep;
+        if (carry > 0) {
+            memcpy(seam + carry, chars, head);
+            const char *hit = searchForward(p, seam, carry + head);
+            if (hit) {
+                *match = offset - carry + (hit - seam);
+                return true;
+            }
+        }
+
+        const char *hit = searchForward(p, chars, n);
+        if (hit) {
+            *match = offset + (hit - chars);
+            return true;
+        }
+
+        seamCarry(seam, &carry, keep, chars, n);
+        offset += n;
+    }
+    return false;
+}
+
+/* First match starting at or after `from`; `resume` is where the search for the one after it picks up. */
+static bool searchNext(const struct searchPattern *p, const struct textBuffer *b, size_t from, size_t *match,
+                       size_t *resume) {
+    if (p->re) return regexBufferForward(p->matcher, b, from, bufferLength(b), match, resume);
+    if (!searchRange(p, b, from, bufferLength(b), p->seam, match)) return false;
+    *resume = *match + 1;
+    return true;
+}
+
+/* First match starting at or after `from`. */
+bool searchBufferForward(const struct searchPattern *p, const struct textBuffer *b, size_t from, size_t *match) {
+    size_t resume;
+    return searchNext(p, b, from, match, &resume);
+}
+
+/* Last match starting before `before`; the mirror image of searchBufferForward. */
+bool searchBufferBackward(const struct searchPattern *p, const struct textBuffer *b, size_t before, size_t *match) {
+    if (p->len == 0 || before == 0) return false;
+    if (p->re) return regexBufferBackward(p->matcher, b, before, match);
+
+    size_t keep = p->len - 1;
+    size_t carry = 0;
+    size_t offset = before + keep;
+    if (offset > bufferLength(b)) offset = bufferLength(b);
+
+    /* seam[keep, keep + carry) holds the first bytes after `offset`. */
+    while (offset > 0) {
+        const char *chars;
+        size_t n = bufferChunkBefore(b, offset, &chars);
+        if (n == 0) break;
+
+        size_t tail = n < keep ? n : keep;
+        if (carry > 0) {
+            memcpy(p->seam + keep - tail, chars + n - tail, tail);
+            const char *hit = searchBackward(p, p->seam + keep - tail, tail + carry);
+            if (hit) {
+                *match = offset - (p->seam + keep - hit);
+                return true;
+            }
+        }
+
+        const char *hit = searchBackward(p, chars, n);
+        if (hit) {
+            *match = offset - n + (hit - chars);
+            return true;
+        }
+
+        if (n >= keep) {
+            memcpy(p->seam + keep, chars, keep);
+            carry = keep;
+        } else {
+            memcpy(p->seam + keep - n, chars, n);
+            carry = n + carry < keep ? n + carry : keep;
+            memmove(p->seam + keep, p->seam + keep - n, carry);
+        }
+        offset -= n;
+    }
+    return false;
+}
+
+static void matchIndexReserve(struct matchIndex *index, size_t count) {
+    if (count <= index->cap) return;
+
+    size_t cap = index->cap ? index->cap : 64;
+    while (cap < count) cap *= 2;
+    index->hits = (size_t *)realloc(index->hits, cap * sizeof(size_t));
+    index->cap = cap;
+}
+
+void matchIndexReset(struct matchIndex *index, const struct textBuffer *b) {
+    index->count = 0;
+    index->covered = 0;
+    index->version = b->version;
+    index->valid = true;
+}
+
+/* Indexes forward until the first hit at or after `offset` is known; false once the text runs out. */
+bool matchIndexExtend(struct matchIndex *index, const struct searchPattern *p, const struct textBuffer *b, size_t offset) {
+    size_t length = bufferLength(b);
+
+    while (index->valid && index->covered < length) {
+        if (index->count > 0 && index->hits[index->count - 1] >= offset) return true;
+
+        size_t match, resume;
+        if (!searchNext(p, b, index->covered, &match, &resume)) {
+            index->covered = length;
+            break;
+        }
+        if (index->count == MATCH_INDEX_MAX) {
+            index->valid = false;
+            break;
+        }
+        matchIndexReserve(index, index->count + 1);
+        index->hits[index->count++] = match;
+        index->covered = resume;
+    }
+    return index->count > 0 && index->hits[index->count - 1] >= offset;
+}
+
+/*
+ * Narrows an index of the plain-text query `p` minus some trailing bytes down to `p` itself.
+ * Each match of `p` starts a match of the shorter query, so only the old hits are checked and
+ * none of the text between them is read; the index stays exact up to where it was covered.
+ */
+bool matchIndexRefine(struct matchIndex *index, const struct searchPattern *p, const struct textBuffer *b) {
+    if (!matchIndexReady(index, b) || p->re || p->len == 0) return false;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        size_t hit = index->hits[i];
+        const char *chars;
+        size_t n = bufferChunk(b, hit, &chars);
+        if (n < p->len) {
+            n = bufferRead(b, hit, p->seam, p->len);
+            chars = p->seam;
+        }
+        if (n >= p->len && memcmp(chars, p->chars, p->len) == 0) index->hits[kept++] = hit;
+    }
+    index->count = kept;
+    return true;
+}
+
+static void hitsPush(size_t **hits, size_t *count, size_t *cap, size_t hit) {
+    if (*count == *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *hits = (size_t *)realloc(*hits, *cap * sizeof(size_t));
+    }
+    (*hits)[(*count)++] = hit;
+}
+
+/*
+ * Start and end offsets of every match in `b`, in file order. Unlike the match index, literal
+ * matches do not overlap here either, since they are about to be replaced. Returns the count.
+ */
+size_t searchBufferAll(const struct searchPattern *p, const struct textBuffer *b, size_t **starts, size_t **ends) {
+    size_t count = 0, startCap = 0, endCount = 0, endCap = 0;
+    size_t from = 0, match, resume;
+
+    *starts = NULL;
+    *ends = NULL;
+    while (searchNext(p, b, from, &match, &resume)) {
+        from = p->re ? resume : match + p->len;
+        hitsPush(starts, &count, &startCap, match);
+        hitsPush(ends, &endCount, &endCap, from);
+    }
+    return count;
+}
+
+/* Replaces the hits in [lo, hi) with `found` new ones. */
+static void matchIndexSplice(struct matchIndex *index, size_t lo, size_t hi, const size_t *hits, size_t found) {
+    if (index->count - (hi - lo) + found > MATCH_INDEX_MAX) {
+        index->valid = false;
+        return;
+    }
+    matchIndexReserve(index, index->count - (hi - lo) + found);
+    if (hi < index->count) {
+        memmove(index->hits + lo + found, index->hits + hi, (index->count - hi) * sizeof(size_t));
+    }
+    if (found > 0) memcpy(index->hits + lo, hits, found * sizeof(size_t));
+    index->count = index->count - (hi - lo) + found;
+}
+
+/* Start of the first line beginning at or after `offset`, or the end of the buffer. */
+static size_t lineStartAfter(const struct textBuffer *b, size_t offset) {
+    size_t line = bufferLineOf(b, offset);
+    size_t start = bufferLineStart(b, line);
+    if (start >= offset) return start;
+    return line + 1 < bufferLineCount(b) ? bufferLineStart(b, line + 1) : bufferLength(b);
+}
+
+/* matchIndexEdit for a regular expression: its matches stay within a line, so the edited lines are searched again whole. */
+static void matchIndexEditLines(struct matchIndex *index, const struct searchPattern *p, const struct textBuffer *b,
+                                size_t offset, size_t removed, size_t inserted) {
+    size_t from = bufferLineStart(b, bufferLineOf(b, offset));
+    if (from >= index->covered) return;
+
+    size_t lo = matchIndexLower(index, from);
+    size_t to = lineStartAfter(b, offset + inserted + 1);
+    if (index->covered < to - inserted + removed) {
+        index->count = lo;
+        index->covered = from;
+        return;
+    }
+
+    size_t hi = matchIndexLower(index, to - inserted + removed);
+    for (size_t i = hi; i < index->count; i++) {
+        index->hits[i] = index->hits[i] - removed + inserted;
+    }
+    index->covered = index->covered - removed + inserted;
+
+    size_t *hits = NULL;
+    size_t found = 0, cap = 0;
+    size_t start, end;
+    for (size_t at = from; regexBufferForward(p->matcher, b, at, to, &start, &end); at = end) {
+        hitsPush(&hits, &found, &cap, start);
+    }
+    matchIndexSplice(index, lo, hi, hits, found);
+    free(hits);
+}
+
+/*
+ * The bytes [offset, offset + removed) were replaced by `inserted` new ones. Only matches that
+ * could touch the edit are dropped and searched for again; later ones just shift.
+ */
+void matchIndexEdit(struct matchIndex *index, const struct searchPattern *p, const struct textBuffer *b,
+                    size_t offset, size_t removed, size_t inserted) {
+    if (!index->valid) return;
+    if (index->version + 1 != b->version || p->len == 0) {
+        index->valid = false;
+        return;
+    }
+    index->version = b->version;
+    if (p->re) {
+        matchIndexEditLines(index, p, b, offset, removed, inserted);
+        return;
+    }
+
+    size_t keep = p->len - 1;
+    size_t from = offset > keep ? offset - keep : 0;
+    if (from >= index->covered) return;
+
+    size_t lo = matchIndexLower(index, from);
+    if (index->covered < offset + removed) {
+        /* The edit runs past the indexed prefix; cut the prefix back to where it is still exact. */
+        index->count = lo;
+        index->covered = from;
+        return;
+    }
+
+    size_t hi = matchIndexLower(index, offset + removed);
+    for (size_t i = hi; i < index->count; i++) {
+        index->hits[i] = index->hits[i] - removed + inserted;
+    }
+    index->covered = index->covered - removed + inserted;
+
+    size_t to = offset + inserted + keep;
+    if (to > bufferLength(b)) to = bufferLength(b);
+    char *window = (char *)malloc(to - from + 1);
+    size_t n = bufferRead(b, from, window, to - from);
+
+    size_t *hits = NULL;
+    size_t found = 0, cap = 0;
+    for (const char *hit = searchForward(p, window, n); hit; hit = searchForward(p, hit + 1, window + n - hit - 1)) {
+        hitsPush(&hits, &found, &cap, from + (hit - window));
+    }
+    matchIndexSplice(index, lo, hi, hits, found);
+    free(hits);
+    free(window);
+}
+
+void matchIndexFree(struct matchIndex *index) {
+    free(index->hits);
+    memset(index, 0, sizeof(*index));
+}
+
+bool matchIndexReady(const struct matchIndex *index, const struct textBuffer *b) {
+    return index->valid && index->version == b->version;
+}
+
+/* Position of the first hit at or after `offset`. */
+size_t matchIndexLower(const struct matchIndex *index, size_t offset) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->hits[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void matchIndexAppend(struct matchIndex *index, const struct searchChunk *chunk) {
+    if (!index->valid) return;
+    if (index->count + chunk->count > MATCH_INDEX_MAX) {
+        index->valid = false;
+        return;
+    }
+    matchIndexReserve(index, index->count + chunk->count);
+    if (chunk->count > 0) memcpy(index->hits + index->count, chunk->hits, chunk->count * sizeof(size_t));
+    index->count += chunk->count;
+    index->covered = chunk->to;
+}
+
+static void searchChunkPush(const struct searchJob *job, struct searchChunk *chunk, size_t match) {
+    chunk->found++;
+    if (__atomic_load_n(&job->countOnly, __ATOMIC_RELAXED)) return;
+    hitsPush(&chunk->hits, &chunk->count, &chunk->cap, match);
+}
+
+/*
+ * Every match starting in [from, to), the last of which may run up to len-1 bytes past `to`.
+ * Like searchRange, but it keeps going through each piece after a hit instead of starting over.
+ */
+static void searchChunkRun(const struct searchJob *job, struct searchChunk *chunk, char *seam,
+                           struct regexMatcher *matcher) {
+    const struct searchPattern *p = job->pattern;
+    if (p->re) {
+        size_t start, end;
+        for (size_t from = chunk->from; regexBufferForward(matcher, job->buffer, from, chunk->to, &start, &end); from = end) {
+            searchChunkPush(job, chunk, start);
+        }
+        return;
+    }
+
+    size_t length = bufferLength(job->buffer);
+    size_t limit = length - chunk->to > p->len - 1 ? chunk->to + p->len - 1 : length;
+    size_t keep = p->len - 1;
+    size_t carry = 0;
+    size_t offset = chunk->from;
+
+    while (offset < limit) {
+        const char *chars;
+        size_t n = bufferChunk(job->buffer, offset, &chars);
+        if (n == 0) break;
+        if (n > limit - offset) n = limit - offset;
+
+        /* Only seam hits starting in the previous piece are new; the rest lie wholly in this one. */
+        size_t head = n < keep ? n : keep;
+        if (carry > 0) {
+            memcpy(seam + carry, chars, head);
+            const char *end = seam + carry + head;
+            for (const char *hit = searchForward(p, seam, end - seam); hit && (size_t)(hit - seam) < carry;
+                 hit = searchForward(p, hit + 1, end - hit - 1)) {
+                searchChunkPush(job, chunk, offset - carry + (hit - seam));
+            }
+        }
+        for (const char *hit = searchForward(p, chars, n); hit; hit = searchForward(p, hit + 1, chars + n - hit - 1)) {
+            searchChunkPush(job, chunk, offset + (hit - chars));
+        }
+
+        seamCarry(seam, &carry, keep, chars, n);
+        offset += n;
+    }
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+static void *searchWorker(void *arg) {
+    struct searchJob *job = (struct searchJob *)arg;
+    char *seam = (char *)malloc(2 * job->pattern->len);
+    struct regexMatcher matcher;
+    if (job->pattern->re) regexMatcherInit(&matcher, job->pattern->re);
+
+    while (!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->chunkCount) break;
+
+        searchChunkRun(job, &job->chunks[i], seam, &matcher);
+        __atomic_store_n(&job->chunks[i].done, true, __ATOMIC_RELEASE);
+    }
+    if (job->pattern->re) regexMatcherFree(&matcher);
+    free(seam);
+    return NULL;
+}
+#endif
+
+/* Searches the text past the covered prefix of `index`; an index that already covers everything starts nothing. */
+void searchJobStart(struct searchJob *job, const struct searchPattern *p, const struct textBuffer *b,
+                    const struct matchIndex *index) {
+    memset(job, 0, sizeof(*job));
+    job->pattern = p;
+    job->buffer = b;
+    job->hitCount = index->count;
+
+    size_t from = index->covered;
+    size_t length = bufferLength(b);
+    if (p->len == 0 || from >= length) return;
+
+    job->chunks = (struct searchChunk *)calloc((length - from + SEARCH_CHUNK - 1) / SEARCH_CHUNK,
+                                               sizeof(struct searchChunk));
+    while (from < length) {
+        size_t to = length - from > SEARCH_CHUNK ? from + SEARCH_CHUNK : length;
+        if (p->re) to = lineStartAfter(b, to);
+        job->chunks[job->chunkCount].from = from;
+        job->chunks[job->chunkCount].to = to;
+        job->chunkCount++;
+        from = to;
+    }
+    job->seam = (char *)malloc(2 * p->len);
+    job->running = true;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus < 1 ? 1 : cpus > SEARCH_WORKERS_MAX ? SEARCH_WORKERS_MAX : (int)cpus;
+    while (job->workerCount < workers &&
+           pthread_create(&job->workers[job->workerCount], NULL, searchWorker, job) == 0) {
+        job->workerCount++;
+    }
+#endif
+}
+
+static bool searchJobThreaded(const struct searchJob *job) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    return job->workerCount > 0;
+#else
+    (void)job;
+    return false;
+#endif
+}
+
+/*
+ * Moves the chunks finished so far into `index`, in file order; called once per frame. Without
+ * worker threads one chunk is searched here instead. Returns false once the job is over.
+ */
+bool searchJobPoll(struct searchJob *job, struct matchIndex *index) {
+    if (!job->running) return false;
+
+    if (!searchJobThreaded(job) && job->next < job->chunkCount) {
+        struct searchChunk *chunk = &job->chunks[job->next++];
+        searchChunkRun(job, chunk, job->seam, job->pattern->matcher);
+        chunk->done = true;
+    }
+
+    while (job->drained < job->chunkCount && __atomic_load_n(&job->chunks[job->drained].done, __ATOMIC_ACQUIRE)) {
+        struct searchChunk *chunk = &job->chunks[job->drained++];
+        matchIndexAppend(index, chunk);
+        if (!index->valid) __atomic_store_n(&job->countOnly, true, __ATOMIC_RELAXED);
+        job->hitCount += chunk->found;
+        free(chunk->hits);
+        chunk->hits = NULL;
+    }
+
+    if (job->drained < job->chunkCount) return true;
+    searchJobStop(job);
+    return false;
+}
+
+/* Cancels the workers and waits for them, which takes at most one chunk each. */
+void searchJobStop(struct searchJob *job) {
+    if (!job->running) return;
+
+    __atomic_store_n(&job->cancel, true, __ATOMIC_RELAXED);
+#if !defined(_WIN32) && !defined(_WIN64)
+    for (int i = 0; i < job->workerCount; i++) {
+        pthread_join(job->workers[i], NULL);
+    }
+    job->workerCount = 0;
+#endif
+    for (size_t i = job->drained; i < job->chunkCount; i++) {
+        free(job->chunks[i].hits);
+    }
+    free(job->chunks);
+    free(job->seam);
+    job->chunks = NULL;
+    job->seam = NULL;
+    job->running = false;
+}
+
+int searchJobProgress(const struct searchJob *job) {
+    return job->chunkCount ? (int)(job->drained * 100 / job->chunkCount) : 100;
+}
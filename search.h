@@ -0,0 +1,112 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <pthread.h>
+#endif
+
+#include "buffer.h"
+
+#define SEARCH_WORKERS_MAX 8
+
+/* How far past the edge of the screen a regular expression match is looked for, since it has no fixed length. */
+#define SEARCH_REGEX_REACH 256
+
+struct regex;
+struct regexMatcher;
+
+/*
+ * A query compiled once per search: Horspool shift tables for both directions plus scratch for
+ * piece seams. A regular expression query keeps its text in `chars` and is searched with `re`
+ * instead, through the main thread's `matcher`.
+ */
+struct searchPattern {
+    char *chars;
+    size_t len;
+    size_t skip[256];
+    size_t skipBack[256];
+    char *seam;
+    struct regex *re;
+    struct regexMatcher *matcher;
+};
+
+/*
+ * Sorted start offsets of every match before `covered`, filled in lazily as the search moves
+ * forward and patched in place as the buffer is edited. Regular expression matches do not
+ * overlap: each search resumes where the previous match ended.
+ */
+struct matchIndex {
+    size_t *hits;
+    size_t count, cap;
+    size_t covered;
+    unsigned long version;
+    bool valid;
+};
+
+/* The hits of one stretch of text; once the index is full they are only counted in `found`. */
+struct searchChunk {
+    size_t from, to;
+    size_t *hits;
+    size_t count, cap;
+    size_t found;
+    bool done;
+};
+
+/*
+ * A whole-buffer search running on worker threads. The text after the match index's covered
+ * prefix is cut into chunks that idle workers claim one at a time; finished chunks are moved
+ * into the index strictly in file order, so it only ever grows a longer exact prefix. Chunks of
+ * a regular expression search end at line starts, since its matches never cross a line. The
+ * buffer must not change while the job runs.
+ */
+struct searchJob {
+    const struct searchPattern *pattern;
+    const struct textBuffer *buffer;
+    struct searchChunk *chunks;
+    size_t chunkCount;
+    size_t next;
+    size_t drained;
+    size_t hitCount;
+    bool running;
+    bool cancel;
+    bool countOnly;
+    char *seam;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_t workers[SEARCH_WORKERS_MAX];
+    int workerCount;
+#endif
+};
+
+void searchCompile(struct searchPattern *p, const char *s, size_t len);
+int searchCompileRegex(struct searchPattern *p, const char *s, size_t len, const char **error);
+void searchFree(struct searchPattern *p);
+
+const char *searchForward(const struct searchPattern *p, const char *s, size_t n);
+const char *searchBackward(const struct searchPattern *p, const char *s, size_t n);
+const char *searchText(const struct searchPattern *p, const char *s, size_t n, bool lineStart, bool lineEnd, size_t *len);
+size_t searchLength(const struct searchPattern *p, const char *s, size_t n, bool lineStart, bool lineEnd);
+size_t searchReach(const struct searchPattern *p);
+
+bool searchBufferForward(const struct searchPattern *p, const struct textBuffer *b, size_t from, size_t *match);
+bool searchBufferBackward(const struct searchPattern *p, const struct textBuffer *b, size_t before, size_t *match);
+size_t searchBufferAll(const struct searchPattern *p, const struct textBuffer *b, size_t **starts, size_t **ends);
+
+void matchIndexReset(struct matchIndex *index, const struct textBuffer *b);
+bool matchIndexExtend(struct matchIndex *index, const struct searchPattern *p, const struct textBuffer *b, size_t offset);
+bool matchIndexRefine(struct matchIndex *index, const struct searchPattern *p, const struct textBuffer *b);
+void matchIndexEdit(struct matchIndex *index, const struct searchPattern *p, const struct textBuffer *b,
+                    size_t offset, size_t removed, size_t inserted);
+void matchIndexFree(struct matchIndex *index);
+bool matchIndexReady(const struct matchIndex *index, const struct textBuffer *b);
+size_t matchIndexLower(const struct matchIndex *index, size_t offset);
+
+void searchJobStart(struct searchJob *job, const struct searchPattern *p, const struct textBuffer *b,
+                    const struct matchIndex *index);
+bool searchJobPoll(struct searchJob *job, struct matchIndex *index);
+void searchJobStop(struct searchJob *job);
+int searchJobProgress(const struct searchJob *job);
+
+#endif
@@ -0,0 +1,497 @@
+/* pread and fdopen are POSIX; madvise with MADV_DONTNEED is a BSD extension that glibc and Darwin keep behind their own switches. */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#if defined(__APPLE__)
+    #define _DARWIN_C_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+#include "source.h"
+
+/* Files that cannot be mapped are read in blocks of this size. */
+#define SOURCE_BLOCK ((size_t)1 << 20)
+
+void lineIndexReserve(struct lineIndex *index, size_t count) {
+    size_t need = (count >> LINE_SEGMENT_SHIFT) + 1;
+    if (need <= index->segmentCap) return;
+
+    index->segments = (size_t **)realloc(index->segments, need * sizeof(size_t *));
+    index->segmentCap = need;
+}
+
+void lineIndexPush(struct lineIndex *index, size_t offset) {
+    size_t n = index->count;
+    size_t segment = n >> LINE_SEGMENT_SHIFT;
+
+    if (segment == index->segmentCount) {
+        if (segment == index->segmentCap) {
+            lineIndexReserve(index, index->segmentCap ? index->segmentCap * 2 * LINE_SEGMENT_SIZE : 0);
+        }
+        index->segments[segment] = (size_t *)malloc(LINE_SEGMENT_SIZE * sizeof(size_t));
+        index->segmentCount++;
+    }
+    index->segments[segment][n & (LINE_SEGMENT_SIZE - 1)] = offset;
+    __atomic_store_n(&index->count, n + 1, __ATOMIC_RELEASE);
+}
+
+/* Bulk lineIndexPush: fills whole segments with memcpy and publishes the count once per segment. */
+void lineIndexAppend(struct lineIndex *index, const size_t *offsets, size_t n) {
+    while (n > 0) {
+        size_t count = index->count;
+        size_t inner = count & (LINE_SEGMENT_SIZE - 1);
+        if (inner == 0) {
+            lineIndexPush(index, offsets[0]);
+            offsets++;
+            n--;
+            continue;
+        }
+
+        size_t take = LINE_SEGMENT_SIZE - inner;
+        if (take > n) take = n;
+        memcpy(index->segments[count >> LINE_SEGMENT_SHIFT] + inner, offsets, take * sizeof(size_t));
+        __atomic_store_n(&index->count, count + take, __ATOMIC_RELEASE);
+        offsets += take;
+        n -= take;
+    }
+}
+
+void lineIndexFree(struct lineIndex *index) {
+    for (size_t i = 0; i < index->segmentCount; i++) {
+        free(index->segments[i]);
+    }
+    free(index->segments);
+    memset(index, 0, sizeof(*index));
+}
+
+size_t lineIndexCount(const struct lineIndex *index) {
+    return __atomic_load_n(&index->count, __ATOMIC_ACQUIRE);
+}
+
+size_t lineIndexGet(const struct lineIndex *index, size_t i) {
+    return index->segments[i >> LINE_SEGMENT_SHIFT][i & (LINE_SEGMENT_SIZE - 1)];
+}
+
+/* Number of newlines that sit before `offset`. */
+size_t lineIndexLower(const struct lineIndex *index, size_t offset) {
+    size_t lo = 0, hi = lineIndexCount(index);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (lineIndexGet(index, mid) < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void sourceInit(struct textSource *src) {
+    memset(src, 0, sizeof(*src));
+}
+
+void sourceFree(struct textSource *src) {
+    sourceWait(src);
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (src->mapped) {
+        munmap(src->chars, src->size);
+    } else {
+        free(src->chars);
+    }
+#else
+    free(src->chars);
+#endif
+    lineIndexFree(&src->lines);
+    free(src->pages);
+    memset(src, 0, sizeof(*src));
+}
+
+size_t sourceLineCount(const struct textSource *src) {
+    if (src->sparse) return __atomic_load_n(&src->lineCount, __ATOMIC_ACQUIRE);
+    return lineIndexCount(&src->lines);
+}
+
+/*
+ * The newline offsets of one block of a sparse source, decoded with memchr from the checkpoint
+ * that ends the block before it. Only the last block can still be growing while the scan runs.
+ */
+static const struct linePage *sourcePage(const struct textSource *src, size_t block) {
+    struct linePages *cache = src->pages;
+#if !defined(_WIN32) && !defined(_WIN64)
+    assert(pthread_equal(cache->owner, pthread_self()));
+#endif
+    size_t total = sourceLineCount(src);
+    size_t first = block << LINE_SEGMENT_SHIFT;
+    size_t want = total > first ? total - first : 0;
+    if (want > LINE_SEGMENT_SIZE) want = LINE_SEGMENT_SIZE;
+
+    cache->clock++;
+    struct linePage *page = &cache->pages[0];
+    for (int i = 0; i < SOURCE_PAGES; i++) {
+        struct linePage *p = &cache->pages[i];
+        if (p->used && p->block == block) {
+            page = p;
+            if (p->count == want) {
+                p->used = cache->clock;
+                return p;
+            }
+            break;
+        }
+        if (p->used < page->used) page = p;
+    }
+
+    size_t pos = block == 0 ? 0 : lineIndexGet(&src->lines, block - 1) + 1;
+    page->count = 0;
+    while (page->count < want) {
+        const char *nl = (const char *)memchr(src->chars + pos, '\n', src->size - pos);
+        page->offsets[page->count++] = nl - src->chars;
+        pos = nl - src->chars + 1;
+    }
+    page->block = block;
+    page->used = cache->clock;
+    return page;
+}
+
+/* Offset of the `i`-th newline. A sparse source answers this from its page cache, so only on the thread that opened it. */
+size_t sourceLineGet(const struct textSource *src, size_t i) {
+    if (!src->sparse) return lineIndexGet(&src->lines, i);
+    return sourcePage(src, i >> LINE_SEGMENT_SHIFT)->offsets[i & (LINE_SEGMENT_SIZE - 1)];
+}
+
+/*
+ * Number of newlines that sit before `offset`; in a sparse source every checkpoint before it closes
+ * a whole block, and as with sourceLineGet only the thread that opened it may ask.
+ */
+size_t sourceLineLower(const struct textSource *src, size_t offset) {
+    if (!src->sparse) return lineIndexLower(&src->lines, offset);
+
+    size_t block = lineIndexLower(&src->lines, offset);
+    const struct linePage *page = sourcePage(src, block);
+    size_t lo = 0, hi = page->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (page->offsets[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (block << LINE_SEGMENT_SHIFT) + lo;
+}
+
+/* Dense sources keep every newline; sparse ones count them and keep every LINE_SEGMENT_SIZE-th. */
+static void sourcePushLine(struct textSource *src, size_t offset) {
+    if (!src->sparse) {
+        lineIndexPush(&src->lines, offset);
+        return;
+    }
+    size_t n = src->lineCount + 1;
+    if ((n & (LINE_SEGMENT_SIZE - 1)) == 0) lineIndexPush(&src->lines, offset);
+    __atomic_store_n(&src->lineCount, n, __ATOMIC_RELEASE);
+}
+
+/* Records the newlines of chars[from, to), stopping early once `maxLines` are known. */
+static size_t sourceScanRange(struct textSource *src, size_t from, size_t to, size_t maxLines) {
+    size_t pos = from;
+
+    while (pos < to && sourceLineCount(src) < maxLines) {
+        const char *nl = (const char *)memchr(src->chars + pos, '\n', to - pos);
+        if (nl == NULL) {
+            pos = to;
+            break;
+        }
+
+        size_t offset = nl - src->chars;
+        if (sourceLineCount(src) == 0) {
+            src->crlf = offset > 0 && src->chars[offset - 1] == '\r';
+        }
+        sourcePushLine(src, offset);
+        pos = offset + 1;
+        __atomic_store_n(&src->scanned, pos, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&src->scanned, pos, __ATOMIC_RELAXED);
+    return pos;
+}
+
+/* Sizes the text arena and the newline segment table up front so loading never reallocates. */
+void sourceReserve(struct textSource *src, size_t size) {
+    if (size > src->cap) {
+        src->chars = (char *)realloc(src->chars, size);
+        src->cap = size;
+    }
+    lineIndexReserve(&src->lines, size);
+}
+
+/*
+ * Reads the stream block by block straight into the arena, indexing each block's newlines as it
+ * lands. Compressed files are inflated on the way, so their text never touches the disk.
+ */
+static int sourceRead(struct textSource *src, FILE *fp, size_t sizeHint) {
+    struct decoder d;
+    decoderInit(&d, fp);
+    src->format = d.format;
+
+    /* One spare byte leaves room for the read that reports end of file. */
+    sourceReserve(src, src->size + (sizeHint ? sizeHint + 1 : SOURCE_BLOCK));
+
+    long n;
+    for (;;) {
+        if (src->size == src->cap) sourceReserve(src, src->cap * 2);
+
+        size_t room = src->cap - src->size;
+        n = decoderRead(&d, src->chars + src->size, room < SOURCE_BLOCK ? room : SOURCE_BLOCK);
+        if (n <= 0) break;
+
+        size_t start = src->size;
+        src->size += (size_t)n;
+        sourceScanRange(src, start, src->size, (size_t)-1);
+    }
+
+    decoderFree(&d);
+    fclose(fp);
+    return n == -1 ? -1 : 0;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+/* Past the first screenful, the file is cut into chunks of this size that workers scan in parallel. */
+#define SCAN_CHUNK ((size_t)8 << 20)
+#define SCAN_WORKERS_MAX 8
+
+struct scanChunk {
+    size_t from, to;
+    size_t *offsets;
+    size_t count, cap;
+    bool done;
+};
+
+struct scanJob {
+    const char *chars;
+    struct scanChunk *chunks;
+    size_t chunkCount;
+    size_t next;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+};
+
+static void scanChunkRun(const char *chars, struct scanChunk *chunk) {
+    size_t pos = chunk->from;
+    while (pos < chunk->to) {
+        const char *nl = (const char *)memchr(chars + pos, '\n', chunk->to - pos);
+        if (nl == NULL) break;
+
+        if (chunk->count == chunk->cap) {
+            chunk->cap = chunk->cap ? chunk->cap * 2 : 1024;
+            chunk->offsets = (size_t *)realloc(chunk->offsets, chunk->cap * sizeof(size_t));
+        }
+        pos = nl - chars;
+        chunk->offsets[chunk->count++] = pos++;
+    }
+}
+
+static void *scanWorker(void *arg) {
+    struct scanJob *job = (struct scanJob *)arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->chunkCount) return NULL;
+
+        scanChunkRun(job->chars, &job->chunks[i]);
+        pthread_mutex_lock(&job->lock);
+        job->chunks[i].done = true;
+        pthread_cond_broadcast(&job->ready);
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+/*
+ * Workers claim chunks in file order and record their newlines privately; this thread appends
+ * the finished chunks to the index strictly in order, so the published prefix only ever grows.
+ */
+static void sourceScanParallel(struct textSource *src, size_t from, int workers) {
+    struct scanJob job;
+    job.chars = src->chars;
+    job.chunkCount = (src->size - from + SCAN_CHUNK - 1) / SCAN_CHUNK;
+    job.chunks = (struct scanChunk *)calloc(job.chunkCount, sizeof(struct scanChunk));
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.ready, NULL);
+    for (size_t i = 0; i < job.chunkCount; i++) {
+        job.chunks[i].from = from + i * SCAN_CHUNK;
+        job.chunks[i].to = i + 1 < job.chunkCount ? from + (i + 1) * SCAN_CHUNK : src->size;
+    }
+
+    pthread_t threads[SCAN_WORKERS_MAX];
+    int started = 0;
+    while (started < workers && pthread_create(&threads[started], NULL, scanWorker, &job) == 0) {
+        started++;
+    }
+    if (started == 0) scanWorker(&job);
+
+    for (size_t i = 0; i < job.chunkCount; i++) {
+        struct scanChunk *chunk = &job.chunks[i];
+        pthread_mutex_lock(&job.lock);
+        while (!chunk->done) pthread_cond_wait(&job.ready, &job.lock);
+        pthread_mutex_unlock(&job.lock);
+
+        if (chunk->count > 0 && lineIndexCount(&src->lines) == 0) {
+            size_t first = chunk->offsets[0];
+            src->crlf = first > 0 && src->chars[first - 1] == '\r';
+        }
+        lineIndexAppend(&src->lines, chunk->offsets, chunk->count);
+        __atomic_store_n(&src->scanned, chunk->to, __ATOMIC_RELAXED);
+        free(chunk->offsets);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_cond_destroy(&job.ready);
+    pthread_mutex_destroy(&job.lock);
+    free(job.chunks);
+}
+
+/*
+ * A sparse scan keeps nothing per line, so it walks the file alone, chunk by chunk, and lets go
+ * of each chunk's pages once counted; they are read back from the page cache if shown again.
+ */
+static void sourceScanSparse(struct textSource *src, size_t from) {
+    long pageSize = sysconf(_SC_PAGESIZE);
+    while (from < src->size) {
+        size_t to = src->size - from > SCAN_CHUNK ? from + SCAN_CHUNK : src->size;
+        sourceScanRange(src, from, to, (size_t)-1);
+
+        size_t start = from / pageSize * pageSize;
+        size_t end = to / pageSize * pageSize;
+        if (end > start) madvise(src->chars + start, end - start, MADV_DONTNEED);
+        from = to;
+    }
+}
+
+static void *sourceScanThread(void *arg) {
+    struct textSource *src = (struct textSource *)arg;
+    size_t from = sourceScanned(src);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cpus > SCAN_WORKERS_MAX ? SCAN_WORKERS_MAX : (int)cpus;
+    if (src->sparse) {
+        sourceScanSparse(src, from);
+    } else if (workers > 1 && src->size - from >= 2 * SCAN_CHUNK) {
+        sourceScanParallel(src, from, workers);
+    } else {
+        sourceScanRange(src, from, src->size, (size_t)-1);
+    }
+    __atomic_store_n(&src->scanDone, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Maps the file read-only and indexes the first `minLines` lines before handing the rest to a
+ * scanner thread. Pipes, files that report no size, like those under /proc, and compressed files
+ * are read instead. Only a mapped file can be `sparse`; the others are in memory whole anyway.
+ */
+int sourceOpen(struct textSource *src, const char *filename, size_t minLines, bool sparse) {
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    unsigned char head[4];
+    bool compressed = S_ISREG(st.st_mode) && pread(fd, head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+                      compressDetect(head, sizeof(head)) != COMPRESS_NONE;
+    if (!S_ISREG(st.st_mode) || st.st_size == 0 || compressed) {
+        FILE *fp = fdopen(fd, "rb");
+        if (fp == NULL) {
+            close(fd);
+            return -1;
+        }
+        /* Text usually shrinks to a fraction of its size; the arena doubles if this guess falls short. */
+        return sourceRead(src, fp, compressed ? (size_t)st.st_size * 4 : 0);
+    }
+
+    void *chars = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (chars == MAP_FAILED) return -1;
+
+    src->chars = (char *)chars;
+    src->size = st.st_size;
+    src->mapped = true;
+    if (sparse) {
+        src->sparse = true;
+        src->pages = (struct linePages *)calloc(1, sizeof(struct linePages));
+        src->pages->owner = pthread_self();
+        lineIndexReserve(&src->lines, src->size >> LINE_SEGMENT_SHIFT);
+    } else {
+        lineIndexReserve(&src->lines, src->size);
+    }
+
+    if (sourceScanRange(src, 0, src->size, minLines) < src->size) {
+        src->scanning = true;
+        if (pthread_create(&src->scanner, NULL, sourceScanThread, src) != 0) {
+            sourceScanThread(src);
+            src->scanning = false;
+        }
+    }
+    return 0;
+}
+#else
+int sourceOpen(struct textSource *src, const char *filename, size_t minLines, bool sparse) {
+    (void)minLines;
+    (void)sparse;
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) return -1;
+
+    long size = 0;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+    }
+    return sourceRead(src, fp, size > 0 ? (size_t)size : 0);
+}
+#endif
+
+/* Whether `filename` is a regular file larger than physical memory, which only a sparse index can open. */
+bool sourceExceedsMemory(const char *filename) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    struct stat st;
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode) || pages <= 0 || pageSize <= 0) return false;
+    return (unsigned long long)st.st_size > (unsigned long long)pages * (unsigned long long)pageSize;
+#else
+    (void)filename;
+    return false;
+#endif
+}
+
+bool sourceScanning(struct textSource *src) {
+    if (src->scanning && __atomic_load_n(&src->scanDone, __ATOMIC_ACQUIRE)) {
+        sourceWait(src);
+    }
+    return src->scanning;
+}
+
+void sourceWait(struct textSource *src) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (src->scanning) {
+        pthread_join(src->scanner, NULL);
+        src->scanning = false;
+    }
+#endif
+}
+
+size_t sourceScanned(const struct textSource *src) {
+    return __atomic_load_n(&src->scanned, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,87 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <pthread.h>
+#endif
+
+#include "compress.h"
+
+#define LINE_SEGMENT_SHIFT 12
+#define LINE_SEGMENT_SIZE ((size_t)1 << LINE_SEGMENT_SHIFT)
+
+/* Sorted newline positions kept in fixed-size segments so entries never move once written. */
+struct lineIndex {
+    size_t **segments;
+    size_t segmentCount, segmentCap;
+    size_t count;
+};
+
+/* SOURCE_PAGES blocks of LINE_SEGMENT_SIZE newline offsets a sparse source decoded last, reused least recently used first. */
+#define SOURCE_PAGES 16
+
+struct linePage {
+    size_t block;
+    size_t count;
+    unsigned long used;
+    size_t offsets[LINE_SEGMENT_SIZE];
+};
+
+/*
+ * Recently decoded blocks of a sparse source. Reading a line fills them in without a lock, so
+ * only the thread that opened the source may ask it for lines.
+ */
+struct linePages {
+    struct linePage pages[SOURCE_PAGES];
+    unsigned long clock;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_t owner;
+#endif
+};
+
+/*
+ * The original text and its newlines. A sparse source, for files too big to index in memory,
+ * keeps only every LINE_SEGMENT_SIZE-th newline in `lines` and finds the rest from there.
+ */
+struct textSource {
+    char *chars;
+    size_t size, cap;
+    bool mapped;
+    bool sparse;
+    size_t lineCount;
+    struct linePages *pages;
+    enum compressFormat format;
+    bool crlf;
+    struct lineIndex lines;
+    size_t scanned;
+    bool scanning;
+    bool scanDone;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_t scanner;
+#endif
+};
+
+void lineIndexReserve(struct lineIndex *index, size_t count);
+void lineIndexPush(struct lineIndex *index, size_t offset);
+void lineIndexAppend(struct lineIndex *index, const size_t *offsets, size_t n);
+void lineIndexFree(struct lineIndex *index);
+size_t lineIndexCount(const struct lineIndex *index);
+size_t lineIndexGet(const struct lineIndex *index, size_t i);
+size_t lineIndexLower(const struct lineIndex *index, size_t offset);
+
+void sourceInit(struct textSource *src);
+void sourceFree(struct textSource *src);
+void sourceReserve(struct textSource *src, size_t size);
+int sourceOpen(struct textSource *src, const char *filename, size_t minLines, bool sparse);
+bool sourceExceedsMemory(const char *filename);
+size_t sourceLineCount(const struct textSource *src);
+size_t sourceLineGet(const struct textSource *src, size_t i);
+size_t sourceLineLower(const struct textSource *src, size_t offset);
+bool sourceScanning(struct textSource *src);
+void sourceWait(struct textSource *src);
+size_t sourceScanned(const struct textSource *src);
+
+#endif
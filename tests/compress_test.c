@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "../compress.h"
+
+/* Round trips through the encoder and decoder of every codec the editor was built with. */
+
+struct sink {
+    char *chars;
+    size_t len, cap;
+};
+
+static int failures;
+
+#define CHECK(cond, what) do { if (!(cond)) { fprintf(stderr, "FAIL %s: %s\n", what, #cond); failures++; } } while (0)
+
+static int sinkWrite(void *ctx, const char *chars, size_t len) {
+    struct sink *s = (struct sink *)ctx;
+    if (s->len + len > s->cap) {
+        s->cap = (s->len + len) * 2;
+        s->chars = (char *)realloc(s->chars, s->cap);
+    }
+    memcpy(s->chars + s->len, chars, len);
+    s->len += len;
+    return 0;
+}
+
+static void encode(enum compressFormat format, const char *text, size_t len, struct sink *out) {
+    struct encoder e;
+    CHECK(encoderInit(&e, format, sinkWrite, out) == 0, compressName(format));
+    CHECK(encoderWrite(&e, text, len) == 0, compressName(format));
+    CHECK(encoderFinish(&e) == 0, compressName(format));
+    encoderFree(&e);
+}
+
+/* Decodes `len` bytes as a file would be read; returns the text, or NULL when the decoder fails. */
+static char *decode(const char *chars, size_t len, enum compressFormat *format, size_t *textLen) {
+    FILE *fp = tmpfile();
+    if (fp == NULL) return NULL;
+    fwrite(chars, 1, len, fp);
+    rewind(fp);
+
+    struct decoder d;
+    decoderInit(&d, fp);
+    *format = d.format;
+
+    size_t cap = 1 << 16, size = 0;
+    char *text = (char *)malloc(cap);
+    long n;
+    while ((n = decoderRead(&d, text + size, cap - size)) > 0) {
+        size += (size_t)n;
+        if (size == cap) text = (char *)realloc(text, cap *= 2);
+    }
+    decoderFree(&d);
+    fclose(fp);
+    if (n == -1) {
+        free(text);
+        return NULL;
+    }
+    *textLen = size;
+    return text;
+}
+
+/* Lines of varied text, long enough to span several of the codecs' buffers. */
+static char *sampleText(size_t *len) {
+    size_t lines = 200000;
+    char *text = (char *)malloc(lines * 32);
+    size_t at = 0;
+    for (size_t i = 0; i < lines; i++) at += (size_t)sprintf(text + at, "line %zu of %zu\n", i * 7919 % lines, lines);
+    *len = at;
+    return text;
+}
+
+static void roundTrip(enum compressFormat format, const char *text, size_t len) {
+    const char *name = compressName(format);
+    struct sink out = { NULL, 0, 0 };
+    encode(format, text, len, &out);
+
+    enum compressFormat found;
+    size_t back = 0;
+    char *decoded = decode(out.chars, out.len, &found, &back);
+    CHECK(decoded != NULL, name);
+    CHECK(found == format, name);
+    CHECK(decoded && back == len && memcmp(decoded, text, len) == 0, name);
+    free(decoded);
+
+    /* Two streams back to back, as `cat a b` makes, read as one text. */
+    size_t one = out.len;
+    sinkWrite(&out, out.chars, one);
+    decoded = decode(out.chars, out.len, &found, &back);
+    CHECK(decoded && back == 2 * len && memcmp(decoded, text, len) == 0 && memcmp(decoded + len, text, len) == 0, name);
+    free(decoded);
+
+    /* A stream cut short is an error, not a shorter text. */
+    decoded = decode(out.chars, one / 2, &found, &back);
+    CHECK(decoded == NULL || back < len, name);
+    free(decoded);
+    free(out.chars);
+}
+
+#if defined(HAVE_ZLIB)
+/* Zero bytes after the last member are padding and read as nothing. */
+static void gzipPadding(const char *text, size_t len) {
+    struct sink out = { NULL, 0, 0 };
+    encode(COMPRESS_GZIP, text, len, &out);
+    char zeros[4096] = { 0 };
+    sinkWrite(&out, zeros, sizeof(zeros));
+
+    enum compressFormat found;
+    size_t back = 0;
+    char *decoded = decode(out.chars, out.len, &found, &back);
+    CHECK(decoded && back == len && memcmp(decoded, text, len) == 0, "gzip padding");
+    free(decoded);
+    free(out.chars);
+}
+#endif
+
+int main(void) {
+    size_t len;
+    char *text = sampleText(&len);
+
+    roundTrip(COMPRESS_NONE, text, len);
+#if defined(HAVE_ZLIB)
+    roundTrip(COMPRESS_GZIP, text, len);
+    gzipPadding(text, len);
+#endif
+#if defined(HAVE_ZSTD)
+    roundTrip(COMPRESS_ZSTD, text, len);
+#endif
+
+    free(text);
+    if (failures == 0) printf("ok\n");
+    return failures ? 1 : 0;
+}
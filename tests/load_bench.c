@@ -0,0 +1,78 @@
+/* For clock_gettime. */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../buffer.h"
+
+/*
+ * Load time of bufferOpen from 10K to 10M short lines. The whole file lands in one arena with one
+ * pass over it for newlines, so the time per line should stay flat as the file grows; the run
+ * fails when the largest file costs over three times as much per line as the 100K one.
+ */
+
+static double benchClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int writeLines(const char *path, size_t lines) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+    for (size_t i = 0; i < lines; i++) fprintf(fp, "key.%zu = value %zu\n", i, i * 7919 % 100003);
+    return fclose(fp);
+}
+
+/* Seconds to open `path`, finish indexing it and reach its last line. */
+static double loadOnce(const char *path, size_t lines) {
+    struct textBuffer b;
+    bufferInit(&b);
+    double start = benchClock();
+    if (bufferOpen(&b, path, 50, false) == -1) {
+        perror(path);
+        exit(1);
+    }
+    bufferSync(&b, true);
+    size_t last = bufferLineStart(&b, bufferLineCount(&b) - 2);
+    double seconds = benchClock() - start;
+
+    if (bufferLineCount(&b) != lines + 1 || last >= bufferLength(&b)) {
+        fprintf(stderr, "%s: expected %zu lines, found %zu\n", path, lines, bufferLineCount(&b) - 1);
+        exit(1);
+    }
+    bufferFree(&b);
+    return seconds;
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    static const size_t sizes[] = { 10000, 100000, 1000000, 10000000 };
+    double base = 0, perLine = 0;
+
+    printf("%10s %10s %10s\n", "lines", "seconds", "ns/line");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/viva-load-%zu.txt", dir, sizes[i]);
+        if (writeLines(path, sizes[i]) == -1) {
+            perror(path);
+            return 1;
+        }
+
+        /* The best of three, so a cold page cache or a busy machine doesn't decide the result. */
+        double best = 0;
+        for (int run = 0; run < 3; run++) {
+            double t = loadOnce(path, sizes[i]);
+            if (run == 0 || t < best) best = t;
+        }
+        remove(path);
+
+        perLine = best * 1e9 / sizes[i];
+        if (sizes[i] == 100000) base = perLine;
+        printf("%10zu %10.4f %10.1f\n", sizes[i], best, perLine);
+    }
+    return perLine > 3 * base ? 1 : 0;
+}
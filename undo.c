@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "undo.h"
+
+/* A run of typing or backspacing grows one record up to this many bytes, then starts another. */
+#define UNDO_RUN_MAX 4096
+
+static void textReserve(struct undoLog *u, size_t n) {
+    if (u->textLen + n <= u->textCap) return;
+    size_t cap = u->textCap ? u->textCap : 4096;
+    while (cap < u->textLen + n) cap *= 2;
+    u->text = (char *)realloc(u->text, cap);
+    u->textCap = cap;
+}
+
+/* Appends a record for `len` bytes of text, which the caller fills in at u->text + record->text. */
+static struct undoRecord *recordPush(struct undoLog *u, int kind, int flags, size_t offset, size_t len) {
+    if (u->count == u->cap) {
+        u->cap = u->cap ? u->cap * 2 : 256;
+        u->records = (struct undoRecord *)realloc(u->records, u->cap * sizeof(struct undoRecord));
+    }
+    textReserve(u, len);
+
+    struct undoRecord *r = &u->records[u->count++];
+    r->offset = offset;
+    r->text = u->textLen;
+    r->length = len;
+    r->kind = (unsigned char)kind;
+    r->flags = (unsigned char)flags;
+    u->textLen += len;
+    u->done = u->count;
+    return r;
+}
+
+/* A new edit makes the undone steps unreachable. */
+static void undoTruncate(struct undoLog *u) {
+    if (u->done == u->count) return;
+    u->textLen = u->records[u->done].text;
+    u->count = u->done;
+    u->open = false;
+}
+
+/* Bytes held by records from `first` on, with their text. */
+static size_t undoBytes(const struct undoLog *u, size_t first) {
+    size_t text = first < u->count ? u->records[first].text : u->textLen;
+    return u->textLen - text + (u->count - first) * sizeof(struct undoRecord);
+}
+
+/*
+ * Past the limit, drops whole steps from the front until at most half of it is left, so the
+ * copying this takes is paid for by the edits that filled the other half. The last step is kept
+ * if it fits the limit on its own; one bigger than that goes too and leaves nothing to undo.
+ */
+static void undoTrim(struct undoLog *u) {
+    if (undoBytes(u, 0) <= u->limit) return;
+
+    size_t cut = u->count, last = u->count;
+    for (size_t i = 0; i < u->count; i++) {
+        if (u->records[i].flags & UNDO_JOINED) continue;
+        last = i;
+        if (undoBytes(u, i) <= u->limit / 2) {
+            cut = i;
+            break;
+        }
+    }
+    if (cut == u->count && last < u->count && undoBytes(u, last) <= u->limit) cut = last;
+
+    size_t base = cut < u->count ? u->records[cut].text : u->textLen;
+    memmove(u->records, u->records + cut, (u->count - cut) * sizeof(struct undoRecord));
+    memmove(u->text, u->text + base, u->textLen - base);
+    u->count -= cut;
+    u->done = u->done > cut ? u->done - cut : 0;
+    u->textLen -= base;
+    for (size_t i = 0; i < u->count; i++) u->records[i].text -= base;
+    if (u->count == 0) u->open = false;
+}
+
+void undoInit(struct undoLog *u, size_t limit) {
+    memset(u, 0, sizeof(*u));
+    u->limit = limit;
+}
+
+void undoInsert(struct undoLog *u, size_t offset, const char *s, size_t len) {
+    if (len == 0) return;
+    undoTruncate(u);
+
+    struct undoRecord *last = u->open && u->count > 0 ? &u->records[u->count - 1] : NULL;
+    if (last && last->kind == UNDO_INSERT && last->offset + last->length == offset &&
+        last->length + len <= UNDO_RUN_MAX) {
+        textReserve(u, len);
+        memcpy(u->text + u->textLen, s, len);
+        u->textLen += len;
+        last->length += len;
+    } else {
+        struct undoRecord *r = recordPush(u, UNDO_INSERT, 0, offset, len);
+        memcpy(u->text + r->text, s, len);
+    }
+    u->open = true;
+    undoTrim(u);
+}
+
+/* Records the `len` bytes at `offset` before they are deleted from `b`. */
+void undoDelete(struct undoLog *u, const struct textBuffer *b, size_t offset, size_t len) {
+    size_t length = bufferLength(b);
+    if (offset >= length || len == 0) return;
+    if (len > length - offset) len = length - offset;
+    undoTruncate(u);
+
+    struct undoRecord *last = u->open && u->count > 0 ? &u->records[u->count - 1] : NULL;
+    bool run = last && last->kind == UNDO_DELETE && last->length + len <= UNDO_RUN_MAX;
+    if (run && offset + len == last->offset) {
+        /* Backspacing: the bytes go in front of the ones deleted before them. */
+        textReserve(u, len);
+        memmove(u->text + last->text + len, u->text + last->text, last->length);
+        bufferRead(b, offset, u->text + last->text, len);
+        u->textLen += len;
+        last->offset = offset;
+        last->length += len;
+    } else if (run && offset == last->offset) {
+        textReserve(u, len);
+        bufferRead(b, offset, u->text + u->textLen, len);
+        u->textLen += len;
+        last->length += len;
+    } else {
+        struct undoRecord *r = recordPush(u, UNDO_DELETE, 0, offset, len);
+        bufferRead(b, offset, u->text + r->text, len);
+    }
+    u->open = true;
+    undoTrim(u);
+}
+
+/*
+ * Records replacing the ranges [starts[i], ends[i]) of `b` with `s` as one step: a delete and an
+ * insert per range, at the offsets they have once the ranges before them are replaced.
+ */
+void undoReplace(struct undoLog *u, const struct textBuffer *b, const size_t *starts, const size_t *ends,
+                 size_t count, const char *s, size_t len) {
+    if (count == 0) return;
+    undoTruncate(u);
+
+    size_t removed = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = starts[i] - removed + i * len;
+        struct undoRecord *r = recordPush(u, UNDO_DELETE, UNDO_REPLACE | (i > 0 ? UNDO_JOINED : 0),
+                                          offset, ends[i] - starts[i]);
+        bufferRead(b, starts[i], u->text + r->text, r->length);
+        r = recordPush(u, UNDO_INSERT, UNDO_REPLACE | UNDO_JOINED, offset, len);
+        memcpy(u->text + r->text, s, len);
+        removed += ends[i] - starts[i];
+    }
+    u->open = false;
+    undoTrim(u);
+}
+
+/* Ends the run being typed, so the next edit starts a step of its own even where it would join. */
+void undoBreak(struct undoLog *u) {
+    u->open = false;
+}
+
+/* The step to undo: records [*first, *first + *count), to be taken back last one first. */
+bool undoBack(struct undoLog *u, size_t *first, size_t *count) {
+    u->open = false;
+    if (u->done == 0) return false;
+
+    size_t i = u->done - 1;
+    while (i > 0 && (u->records[i].flags & UNDO_JOINED)) i--;
+    *first = i;
+    *count = u->done - i;
+    u->done = i;
+    return true;
+}
+
+/* The step to redo: records [*first, *first + *count), applied in order. */
+bool undoForward(struct undoLog *u, size_t *first, size_t *count) {
+    u->open = false;
+    if (u->done == u->count) return false;
+
+    size_t i = u->done + 1;
+    while (i < u->count && (u->records[i].flags & UNDO_JOINED)) i++;
+    *first = u->done;
+    *count = i - u->done;
+    u->done = i;
+    return true;
+}
+
+/*
+ * For a step recorded by undoReplace, the ranges to replace and the text for each, so the whole
+ * step is one rebuild of the buffer. Forward, the ranges are the original matches and get the
+ * replacement; backward, they are the replacements and get the matched text back. The arrays
+ * are malloc'ed and `text` holds the texts back to back. Returns the number of ranges.
+ */
+size_t undoReplaceRanges(const struct undoLog *u, size_t first, size_t count, bool forward,
+                         size_t **starts, size_t **ends, char **text, size_t **lens) {
+    size_t n = count / 2;
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) total += u->records[first + 2 * i + forward].length;
+
+    *starts = (size_t *)malloc((n ? n : 1) * sizeof(size_t));
+    *ends = (size_t *)malloc((n ? n : 1) * sizeof(size_t));
+    *lens = (size_t *)malloc((n ? n : 1) * sizeof(size_t));
+    *text = (char *)malloc(total ? total : 1);
+
+    size_t removed = 0, added = 0, at = 0;
+    for (size_t i = 0; i < n; i++) {
+        const struct undoRecord *del = &u->records[first + 2 * i];
+        const struct undoRecord *ins = del + 1;
+        const struct undoRecord *put = forward ? ins : del;
+
+        if (forward) {
+            (*starts)[i] = del->offset + removed - added;
+            (*ends)[i] = (*starts)[i] + del->length;
+        } else {
+            (*starts)[i] = ins->offset;
+            (*ends)[i] = ins->offset + ins->length;
+        }
+        (*lens)[i] = put->length;
+        memcpy(*text + at, u->text + put->text, put->length);
+        at += put->length;
+        removed += del->length;
+        added += ins->length;
+    }
+    return n;
+}
+
+/* Forgets the history, as when the text is replaced wholesale. */
+void undoClear(struct undoLog *u) {
+    u->count = 0;
+    u->done = 0;
+    u->textLen = 0;
+    u->open = false;
+}
+
+void undoFree(struct undoLog *u) {
+    free(u->records);
+    free(u->text);
+    memset(u, 0, sizeof(*u));
+}
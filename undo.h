@@ -0,0 +1,64 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "buffer.h"
+
+/* Bytes of history kept, records and text together; the oldest steps go first. */
+#define UNDO_LIMIT ((size_t)256 << 20)
+
+enum undoKind {
+    UNDO_INSERT,
+    UNDO_DELETE
+};
+
+/* Undone and redone together with the record before it. */
+#define UNDO_JOINED 1
+
+/* Part of a step recorded by undoReplace, which can be applied as one bufferReplaceEach. */
+#define UNDO_REPLACE 2
+
+/*
+ * One edit: `length` bytes inserted at or deleted from `offset`, whose bytes start at `text` in
+ * the log's text. Nothing else is kept, so a record costs 32 bytes plus the text it stands for.
+ */
+struct undoRecord {
+    size_t offset;
+    size_t text;
+    size_t length;
+    unsigned char kind;
+    unsigned char flags;
+};
+
+/*
+ * Undo history as one log of records with their text in a single arena, in edit order. Records
+ * before `done` are applied and the rest can be redone; a new edit drops the ones that could.
+ * Typing and backspacing grow the last record while `open`, so a run of keys is one step. Once
+ * the log passes `limit`, the oldest steps are cut off half of it at a time.
+ */
+struct undoLog {
+    struct undoRecord *records;
+    size_t count, cap;
+    size_t done;
+    char *text;
+    size_t textLen, textCap;
+    size_t limit;
+    bool open;
+};
+
+void undoInit(struct undoLog *u, size_t limit);
+void undoInsert(struct undoLog *u, size_t offset, const char *s, size_t len);
+void undoDelete(struct undoLog *u, const struct textBuffer *b, size_t offset, size_t len);
+void undoReplace(struct undoLog *u, const struct textBuffer *b, const size_t *starts, const size_t *ends,
+                 size_t count, const char *s, size_t len);
+void undoBreak(struct undoLog *u);
+bool undoBack(struct undoLog *u, size_t *first, size_t *count);
+bool undoForward(struct undoLog *u, size_t *first, size_t *count);
+size_t undoReplaceRanges(const struct undoLog *u, size_t first, size_t count, bool forward,
+                         size_t **starts, size_t **ends, char **text, size_t **lens);
+void undoClear(struct undoLog *u);
+void undoFree(struct undoLog *u);
+
+#endif